@@ -0,0 +1,45 @@
+/************************************************************************************
+*	atomic.s
+*
+*	Defines the atomic operations on double words (64 bits) declared in atomic.h
+*   (lib/kernel). The 32 bits ones are inline functions of atomic.h.
+*
+*   LDREXD and STREXD need an even and consecutive pair of registers, so they are written
+*   here instead of with inline assembly. The double word has to be 8 bytes aligned.
+*
+*************************************************************************************/
+
+.section .text
+
+/*
+* Adds the value in r2 (low word) and r3 (high word) to the double word at the address in r0.
+* Returns the new value in r0 (low word) and r1 (high word).
+*
+* Signature:	uint64_t atomic_add_64(volatile uint64_t *address, uint64_t value)
+*/
+.globl atomic_add_64
+atomic_add_64:
+	push {r4, r5}					// (r5 keeps the stack 8 bytes aligned.)
+	mov r12, r0						// r12 = address.
+atomic_add_64_retry$:
+	ldrexd r0, r1, [r12]			// r0, r1 = double word (exclusive).
+	adds r0, r0, r2
+	adc r1, r1, r3
+	strexd r4, r0, r1, [r12]		// r4 = 0 if the double word was written.
+	cmp r4, #0
+	bne atomic_add_64_retry$		// Interrupted: retrying with the new value.
+	pop {r4, r5}
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Reads the double word at the address in r0 in a single access. Returns it in r0 (low word) and
+* r1 (high word).
+*
+* Signature:	uint64_t atomic_read_64(const volatile uint64_t *address)
+*/
+.globl atomic_read_64
+atomic_read_64:
+	mov r12, r0
+	ldrexd r0, r1, [r12]
+	mov pc, lr						// Returning to the caller.
@@ -23,8 +23,10 @@ graphicsAddress:
 
 /* NEW
 * Font stores the bitmap images for the first 128 characters.
+* It is also read by video_draw_character() (devices/video.c).
 */
 .align 4
+.globl font
 font:
 	.incbin "font.bin"
 
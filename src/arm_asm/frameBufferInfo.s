@@ -9,7 +9,8 @@
 * consists of a pointer to the structure below. The comments explain what each
 * member of the structure is.
 * The .align 12 is necessary to ensure correct communication with the GPU, 
-* which expects page alignment.
+* which expects page alignment. The structure is padded to 64 bytes, so it
+* fills two whole cache lines that it doesn't share with any other data.
 * C++ Signature: 
 * struct FrameBuferDescription {
 *  u32 width; u32 height; u32 vWidth; u32 vHeight; u32 pitch; u32 bitDepth;
@@ -32,6 +33,7 @@ FrameBufferInfo:
 	.int 0		/* #28 Y */
 	.int 0		/* #32 GPU - Pointer */
 	.int 0		/* #36 GPU - Size */
+	.space 24	/* #40 Padding up to two cache lines (64 bytes). */
 
 /* 
 * InitialiseFrameBuffer creates a frame buffer of width and height specified in
@@ -68,6 +70,10 @@ InitialiseFrameBuffer:
 	.unreq height
 	.unreq bitDepth
 
+	mov r0,fbInfoAddr
+	mov r1,#64
+	bl cache_clean_range	/* The GPU reads the message from memory. */
+
 	mov r0,fbInfoAddr
 	add r0,#0x40000000
 	mov r1,#1
@@ -80,6 +86,10 @@ InitialiseFrameBuffer:
 	movne result,#0
 	popne {r4,pc}
 
+	mov r0,fbInfoAddr
+	mov r1,#64
+	bl cache_invalidate_range	/* Reads the GPU's reply from memory. */
+
 	mov result,fbInfoAddr
 	pop {r4,pc}
 	.unreq result
@@ -6,6 +6,8 @@
 *
 *************************************************************************************/
 
+.fpu vfp
+
 .section .data
 
 .align 4
@@ -14,6 +16,21 @@ exec_int_msg:
   		.asciz "\n!!!!!!!!!!!!! Executing SWI interrupt !!!!!!!!!!!!!!!"
 // .asciz ends the string with null ('\0').
 
+/* System call numbers used in this file (lib/syscall-nr.h). */
+.equ SYS_TIME, 21
+.equ SYSCALL_COUNT, 22
+
+/* Counter (lower 32 bits) of the system timer (1 MHz). */
+.equ SYSTEM_TIMER_CLO, 0x20003004
+
+/* Ring of the FIQ samples: size (FIQ_RING_SIZE in fiq.h) and offsets of struct fiq_ring (fiq.c). */
+.equ FIQ_RING_SIZE, 256
+.equ FIQ_RING_HEAD, 0
+.equ FIQ_RING_TAIL, 4
+.equ FIQ_RING_DROPPED, 8
+.equ FIQ_RING_ACK_VALUE, 12
+.equ FIQ_RING_SAMPLES, 16
+
 .section .text
 
 /* Prints a message indicating that an interrupt is being executed.
@@ -26,47 +43,65 @@ print_executing_interrupt:
 	bl printf
 	pop {pc}
 
-/* Generates a Software Interrupt.
-* void generate_swi_interrupt()
+/* Invokes a system call: moves the number to r7 and the arguments to r0-r2, and generates a
+* Software Interrupt.
+*
+* Signature:	int32_t syscall(int number, uint32_t arg0, uint32_t arg1, uint32_t arg2)
 */
-.globl generate_swi_interrupt
-generate_swi_interrupt:
-	push {lr}
-	//bl print_executing_interrupt
-	swi 0x11
-	pop {pc}
-
-
-/* Handles the software interrupts. It extracts the SWI number an pass it to the handler
-* written in C. It accesses to the parameter through the LR register.
-* void swi_handler_int()
+.globl syscall
+syscall:
+	push {r7, lr}
+	mov r7, r0					// r7 = system call number.
+	mov r0, r1					// r0-r2 = arguments.
+	mov r1, r2
+	mov r2, r3
+	swi 0
+	pop {r7, pc}				// The result is in r0.
+
+
+/* Handles the software interrupts (system calls).
+*
+* ABI: the system call number is in r7 (lib/syscall-nr.h) and its arguments in r0-r2. The result
+* is returned in r0. Like in a function call, r1-r3 and r12 are not preserved.
+*
+* SYS_TIME only reads the system timer, so it returns without saving anything. The other system
+* calls change to SYS mode (the mode of the threads) and save in the stack of the thread only the
+* CPSR of the caller, the return address and the LR of the thread. Then the C function of the
+* syscall_table (syscall.c) is called with the arguments already in r0-r2, and with the interrupts
+* level of the caller. The state is in the stack of the thread and not in the SVC stack, so the
+* system call can block or yield.
+*
+* Signature void swi_handler_int()
 */
 .globl swi_handler_int
 swi_handler_int:
-	mov r0, #0x5
-	mov r12, #0xc
-
-	stmfd sp!, {r0-r12,lr}			// Saving context
-
-	// Store CPSR and SPSR in the stack.
-	mrs r0, cpsr
-	mrs r1, spsr
-	stmfd sp!, {r0,r1}				// Store CPSR and SPSR in the stack.
-
-	// Call the SWI dispatcher with the Stack Frame and the SWI number.
-	mov r0, sp						// Passing the Stack Frame address to the function.
-	ldr r1, [lr, #-4]				// Read the SWI instruction to extract the parameter
-	bic r1, r1, #0xff000000 	 	// Mask off top 8 bits to extract the parameter.
-	bl interrupts_dispatch_swi		// Calling the SWI handler that is defined inn interrupts.c.
-
-	// Restoring CPSR and SPSR from the stack.
-	ldmfd sp!, {r0,r1}				// Restoring CPSR and SPSR from the stack.
-   	msr cpsr, r0
-  	msr spsr, r1
-
-	ldmfd sp!, {r0-r12,pc}^				// After the exception, it is necessary to return to the
-									// address pointed by LR.
-									// (ARM System Developer Guides, 1st edition, pg 323)
+	cmp r7, #SYS_TIME
+	beq swi_handler_time$
+
+	mrs r3, spsr				// r3 = CPSR of the caller.
+	mov r12, lr					// r12 = return address.
+	msr cpsr_c, #0xdf			// Changing mode to SYS with interrupts disabled.
+	stmfd sp!, {r3,r12,lr}		// Saving the CPSR, the return address and the LR of the thread.
+	orr r12, r3, #0x1f			// SYS mode with the interrupt flags of the caller.
+	msr cpsr_c, r12
+
+	cmp r7, #SYSCALL_COUNT
+	ldrlo r12, =syscall_table
+	ldrlo r12, [r12, r7, lsl #2]	// r12 = syscall_table[r7]
+	ldrhs r12, =syscall_invalid
+	mov lr, pc
+	mov pc, r12					// Calling the system call. The result is in r0.
+
+	msr cpsr_c, #0xdf			// Disabling the interrupts to restore the state.
+	ldmfd sp!, {r3,r12,lr}		// Restoring the CPSR, the return address and the LR of the thread.
+	msr cpsr_c, #0xd3			// Changing mode to SVC with interrupts disabled.
+	msr spsr_cxsf, r3
+	movs pc, r12				// Returning to the caller (CPSR = SPSR).
+
+swi_handler_time$:
+	ldr r0, =SYSTEM_TIMER_CLO
+	ldr r0, [r0]				// r0 = system timer counter.
+	movs pc, lr					// Returning to the caller (CPSR = SPSR).
 
 
 /* Handles the IRQ interrupts.
@@ -74,6 +109,8 @@ swi_handler_int:
 * When this method is executed the MODE is IRQ and the the previous MODE has to be USER's mode.
 * The processing status of the USER's mode is saved in SPRS.
 *
+* The FIQ is kept enabled while the IRQ is handled: the FIQ handler only uses its banked registers.
+*
 * Signature void irq_handler_int()
 */
 .globl irq_handler_int
@@ -83,11 +120,11 @@ irq_handler_int:
 	stmfd sp!, {r0-r12}			    // Saving context (r0-r12).
 
 	/* Change to SYS Mode to save the SP_USR and LR_USR. */
-	mov r0, #0xdf		// (SYS_MODE + NO_INT = 0x1f + 0xc = 0xdf)
+	mov r0, #0x9f		// (SYS_MODE + NO_IRQ = 0x1f + 0x8 = 0x9f)
 	msr cpsr_c, r0
 	mov r1, sp			// Setting the USER's SP.
 	mov r2, lr			// Setting the USER's LR.
-	mov r0, #0xd2		// Changing mode to IRQ with interrups disable.
+	mov r0, #0x92		// Changing mode to IRQ with IRQs disabled.
 	msr cpsr_c, r0
 
 	stmfd sp!, {r1,r2,lr}	// Saving context (sp_usr, lr_usr, pc_usr).
@@ -100,6 +137,11 @@ irq_handler_int:
 	mov r0, sp						// Passing the Stack Frame address to the function.
 	bl interrupts_dispatch_irq		// Calling the IRQ handler that is defined in interrupts.c.
 
+	/* Clearing the exclusive monitor (ARMv6 has no CLREX): a ldrex/strex sequence interrupted here
+	   has to fail, because another thread may have run. The word is written with its own value. */
+	ldr r1, [sp]
+	strex r2, r1, [sp]
+
 	// Restoring SPSR (USER's CPSR) from the stack.
 	ldmfd sp!, {r0}				// Restoring SPSR (USER's CPSR) from the stack.
 	msr spsr, r0
@@ -108,17 +150,256 @@ irq_handler_int:
 	ldmfd sp!, {r1,r2,lr}		// Restoring (sp_usr, lr_usr, pc_usr)
 
 	/* Setting the sp_usr and lr_usr in the SYS MODE. */
-	mov r0, #0xdf		// (SYS_MODE + NO_INT = 0x1f + 0xc = 0xdf)
+	mov r0, #0x9f		// (SYS_MODE + NO_IRQ = 0x1f + 0x8 = 0x9f)
 	msr cpsr_c, r0
 	mov sp, r1			// Restoring the USER's SP.
 	mov lr, r2			// Restoring the USER's LR.
-	mov r0, #0xd2		// Changing mode to IRQ with interrups disable.
+	mov r0, #0x92		// Changing mode to IRQ with IRQs disabled.
 	msr cpsr_c, r0
 
 	// Restoring all the registers from the Stack frame.
 	ldmfd sp!, {r0-r12}		// After the exception, it is necessary to return to the instruction
 	movs pc, lr				// that was being executed before the interruption.
 
+/* Handles the FIQ of the source routed by fiq_enable() (threads/fiq.c).
+*
+* It doesn't save any register: it only uses r8-r14, which are banked in FIQ mode. r8 (data
+* register), r9 (acknowledge register or 0) and r11 (ring) are set by fiq_set_registers, and r10,
+* r12 and r13 are scratch. The sample is added to the ring and published by writing the head after
+* it, or counted as dropped if the ring is full.
+*
+* Signature void fiq_handler_int()
+*/
+.globl fiq_handler_int
+fiq_handler_int:
+	ldr r12, [r8]					// r12 = sample (data register of the device).
+	cmp r9, #0
+	ldrne r13, [r11, #FIQ_RING_ACK_VALUE]
+	strne r13, [r9]					// Clearing the interrupt in the device.
+
+	ldr r13, [r11, #FIQ_RING_HEAD]
+	ldr r10, [r11, #FIQ_RING_TAIL]
+	sub r10, r13, r10				// r10 = samples in the ring.
+	cmp r10, #FIQ_RING_SIZE
+	bhs fiq_handler_full$
+
+	and r10, r13, #(FIQ_RING_SIZE - 1)
+	add r10, r11, r10, lsl #2
+	str r12, [r10, #FIQ_RING_SAMPLES]	// ring->samples[head % FIQ_RING_SIZE] = sample.
+	add r13, r13, #1
+	str r13, [r11, #FIQ_RING_HEAD]	// Publishing the sample.
+	subs pc, lr, #4					// Returning (CPSR = SPSR).
+
+fiq_handler_full$:
+	ldr r13, [r11, #FIQ_RING_DROPPED]
+	add r13, r13, #1
+	str r13, [r11, #FIQ_RING_DROPPED]
+	subs pc, lr, #4					// Returning (CPSR = SPSR).
+
+/* Sets the banked registers of the FIQ mode used by fiq_handler_int: r8 = data register, r9 =
+* acknowledge register and r11 = ring. The registers r8-r12 of the caller are not modified,
+* because they are banked too.
+*
+* Signature:	void fiq_set_registers(volatile uint32_t *data_register,
+*					volatile uint32_t *ack_register, volatile struct fiq_ring *ring)
+*/
+.globl fiq_set_registers
+fiq_set_registers:
+	mrs r3, cpsr
+	msr cpsr_c, #0xd1				// Changing mode to FIQ with interrupts disabled.
+	mov r8, r0
+	mov r9, r1
+	mov r11, r2
+	msr cpsr_c, r3					// Back to the mode of the caller.
+	mov pc, lr						// Returning to the caller.
+
+
+/* Calls the handler of a nested IRQ in SYS mode with the IRQs enabled, and returns in IRQ mode
+* with the IRQs disabled.
+*
+* The handler can't run in IRQ mode with the IRQs enabled: a nested IRQ would overwrite lr_irq,
+* which holds its return addresses. In SYS mode it runs on the stack of the interrupted thread,
+* so thread_current() keeps working. The SP and LR of the SYS mode are restored from the stack
+* frame when the outermost IRQ returns, and a nested IRQ saves and restores them on its own
+* frame, so they don't have to be preserved here.
+*
+* Signature:	void irq_call_nested_handler(interrupts_handler_function *handler,
+*					struct interrupts_stack_frame *stack_frame, void *dev)
+*/
+.globl irq_call_nested_handler
+irq_call_nested_handler:
+	push {r4, lr}					// On the IRQ stack.
+	mov r12, r0						// r12 = handler.
+	mov r0, r1						// r0 = stack frame (first handler argument).
+	mov r1, r2						// r1 = dev (second handler argument).
+	mrs r4, cpsr					// r4 = CPSR of the IRQ mode.
+	bic r3, r4, #0x9f
+	orr r3, r3, #0x1f				// SYS mode with the IRQs enabled (the FIQ flag is kept).
+	msr cpsr_c, r3
+	mov lr, pc
+	mov pc, r12						// Calling the handler.
+	msr cpsr_c, r4					// Back to IRQ mode with the IRQs disabled.
+	pop {r4, pc}
+
+
+/* Handles the undefined instructions.
+*
+* The VFP is disabled while the running thread doesn't own its registers (see threads/vfp.c), so
+* the first VFP instruction of a thread after a context switch is undefined. In that case the
+* registers are switched by vfp_switch(), called in SYS mode on the stack of the thread, and the
+* instruction is executed again. Any other undefined instruction is reported by
+* interrupts_dispatch_undefined() with the same stack frame that irq_handler_int saves.
+*
+* Signature void undefined_handler_int()
+*/
+.globl undefined_handler_int
+undefined_handler_int:
+	stmfd sp!, {r0-r3}
+	mrs r0, spsr
+	and r1, r0, #0x3f				// Mode and Thumb bit of the caller.
+	cmp r1, #0x1f					// SYS mode (threads) in ARM state...
+	cmpne r1, #0x10					// ...or USER mode in ARM state.
+	bne undefined_handler_other$
+
+	ldr r0, [lr, #-4]				// r0 = undefined instruction.
+	and r1, r0, #0x0e000000
+	cmp r1, #0x0c000000				// LDC/STC (bits [27:25] = 0b110)...
+	andne r1, r0, #0x0f000000
+	cmpne r1, #0x0e000000			// ...or CDP/MCR/MRC (bits [27:24] = 0b1110)...
+	bne undefined_handler_other$
+	and r1, r0, #0xe00
+	cmp r1, #0xa00					// ...of the coprocessor 10 or 11 (VFP).
+	bne undefined_handler_other$
+	fmrx r1, fpexc
+	tst r1, #0x40000000				// Is the VFP already enabled (FPEXC.EN)?
+	bne undefined_handler_other$
+
+	msr cpsr_c, #0xdf				// Changing mode to SYS with interrupts disabled.
+	push {r12, lr}					// Not preserved by the call.
+	bl vfp_switch					// Defined in vfp.c.
+	pop {r12, lr}
+	msr cpsr_c, #0xdb				// Changing mode to UNDEFINED with interrupts disabled.
+	ldmfd sp!, {r0-r3}
+	subs pc, lr, #4					// Executing the instruction again (CPSR = SPSR).
+
+undefined_handler_other$:
+	ldmfd sp!, {r0-r3}
+	sub lr, lr, #4					// lr points to the undefined instruction.
+	stmfd sp!, {r0-r12}			    // Saving context (r0-r12).
+
+	/* Change to SYS Mode to save the SP_USR and LR_USR. */
+	mov r0, #0xdf		// (SYS_MODE + NO_INT = 0x1f + 0xc = 0xdf)
+	msr cpsr_c, r0
+	mov r1, sp			// Setting the USER's SP.
+	mov r2, lr			// Setting the USER's LR.
+	mov r0, #0xdb		// Changing mode to UNDEFINED with interrups disable.
+	msr cpsr_c, r0
+
+	stmfd sp!, {r1,r2,lr}	// Saving context (sp_usr, lr_usr, pc_usr).
+
+	mrs r0, spsr
+	stmfd sp!, {r0}				// Store SPSR (USER's CPSR) in the stack.
+
+	mov r0, sp						// Passing the Stack Frame address to the function.
+	bl interrupts_dispatch_undefined	// Defined in interrupts.c. It doesn't return.
+undefined_handler_hang$:
+	b undefined_handler_hang$
+
+/* Handles the data aborts.
+*
+* Saves the same stack frame that irq_handler_int saves (the SP and LR are the ones of the SYS
+* mode, where the threads run) and calls the handler written in C with the fault address (FAR)
+* and the fault status (DFSR). If the handler returns, the instruction that caused the abort is
+* executed again.
+*
+* If the handler returns true, the fault is a demand paging fault that has to be resolved by the
+* thread, because it allocates memory (and can sleep on a lock). The return goes instead to
+* data_abort_resolve in SYS mode, with the fault address, the CPSR of the thread and the address
+* of the instruction to retry pushed on the stack of the thread.
+*
+* Signature void data_abort_handler_int()
+*/
+.globl data_abort_handler_int
+data_abort_handler_int:
+	sub lr, lr, #8					// lr points to the instruction that caused the abort.
+	stmfd sp!, {r0-r12}			    // Saving context (r0-r12).
+
+	/* Change to SYS Mode to save the SP_USR and LR_USR. */
+	mov r0, #0xdf		// (SYS_MODE + NO_INT = 0x1f + 0xc = 0xdf)
+	msr cpsr_c, r0
+	mov r1, sp			// Setting the USER's SP.
+	mov r2, lr			// Setting the USER's LR.
+	mov r0, #0xd7		// Changing mode to ABORT with interrups disable.
+	msr cpsr_c, r0
+
+	stmfd sp!, {r1,r2,lr}	// Saving context (sp_usr, lr_usr, pc_usr).
+
+	mrs r0, spsr
+	stmfd sp!, {r0}				// Store SPSR (USER's CPSR) in the stack.
+
+	// Calling the data abort handler.
+	mov r0, sp						// Passing the Stack Frame address to the function.
+	mrc p15, 0, r1, c6, c0, 0		// Fault Address Register (FAR).
+	mrc p15, 0, r2, c5, c0, 0		// Data Fault Status Register (DFSR).
+	mov r4, r1						// r4 = fault address (r4 is restored from the frame later).
+	bl interrupts_dispatch_data_abort	// Defined in interrupts.c.
+
+	cmp r0, #0
+	beq data_abort_handler_return$
+
+	/* Demand paging: push (pc, cpsr, fault address) on the stack of the thread and return to
+	   data_abort_resolve in SYS mode with the interrupts disabled. */
+	ldr r0, [sp, #4]			// r0 = sp_usr.
+	ldr r1, [sp, #12]			// r1 = pc_usr (instruction to retry).
+	ldr r2, [sp]				// r2 = USER's CPSR.
+	stmdb r0!, {r1,r2,r4}
+	str r0, [sp, #4]			// sp_usr = sp_usr - 12.
+	ldr r1, =data_abort_resolve
+	str r1, [sp, #12]			// pc_usr = data_abort_resolve.
+	orr r2, r2, #0x9f			// SYS mode with IRQ disabled.
+	str r2, [sp]
+
+	data_abort_handler_return$:
+	ldmfd sp!, {r0}				// Restoring SPSR (USER's CPSR) from the stack.
+	msr spsr, r0
+
+	ldmfd sp!, {r1,r2,lr}		// Restoring (sp_usr, lr_usr, pc_usr)
+
+	/* Setting the sp_usr and lr_usr in the SYS MODE. */
+	mov r0, #0xdf		// (SYS_MODE + NO_INT = 0x1f + 0xc = 0xdf)
+	msr cpsr_c, r0
+	mov sp, r1			// Restoring the USER's SP.
+	mov lr, r2			// Restoring the USER's LR.
+	mov r0, #0xd7		// Changing mode to ABORT with interrups disable.
+	msr cpsr_c, r0
+
+	ldmfd sp!, {r0-r12}		// Restoring all the registers and executing again the
+	movs pc, lr				// instruction that caused the abort.
+
+/* Resolves a demand paging fault in the thread that caused it (SYS mode). data_abort_handler_int
+* returns here with the stack of the thread holding: pc to retry, CPSR and fault address. All the
+* other registers have the values of the faulting instruction.
+*
+* It calls interrupts_resolve_data_abort(fault_address) with the interrupts level of the thread,
+* restores the registers and the CPSR and jumps back to the faulting instruction.
+*/
+.globl data_abort_resolve
+data_abort_resolve:
+	stmfd sp!, {r0-r3,r12,lr}		// Saving the registers that the C function can modify.
+	ldr r0, [sp, #28]
+	orr r0, r0, #0x1f
+	msr cpsr_c, r0					// SYS mode with the interrupts level of the thread.
+	ldr r0, [sp, #32]				// r0 = fault address.
+	bl interrupts_resolve_data_abort	// Defined in interrupts.c.
+
+	msr cpsr_c, #0xdf				// SYS mode with interrupts disabled.
+	ldmfd sp!, {r0-r3,r12,lr}
+	str r0, [sp, #8]				// The fault address is not needed: keeps r0 there.
+	ldr r0, [sp, #4]
+	msr cpsr_fc, r0					// Restoring the flags, the mode and the interrupts level.
+	ldr r0, [sp, #8]
+	ldr pc, [sp], #12				// Retrying the instruction and popping the 3 words.
+
 /* Returns the CPSR status register.
 *
 * Signature:	int get_cpsr_value(void)
@@ -18,6 +18,8 @@ GetMailboxBase:
 /*
 * MailboxRead returns the current value in the mailbox addressed to a channel
 * given in the low 4 bits of r0, as the top 28 bits of r0.
+* If the GPU wrote a reply in a message, the caller has to invalidate it with
+* cache_invalidate_range() (mmu.s) before reading it.
 * C++ Signature: u32 MailboxRead(u8 channel)
 */
 .globl MailboxRead
@@ -44,6 +46,8 @@ MailboxRead:
 /*
 * MailboxWrite writes the value given in the top 28 bits of r0 to the channel
 * given in the low 4 bits of r1.
+* If the value is the address of a message, the caller has to clean it with
+* cache_clean_range() (mmu.s) first, so the GPU finds it in memory.
 * C++ Signature: void MailboxWrite(u32 value, u8 channel)
 */
 .globl MailboxWrite
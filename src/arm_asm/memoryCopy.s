@@ -29,7 +29,7 @@ memory_fastest_copy:
 	// We're going to use r3 through r12, so block size is 10 words = 40 bytes
 	memory_fastest_copy_while_10_words$:
 		cmp size, #40				// four bytes per word, 10 word registers = 40 bytes copied in each iteration.
-		bls memory_fastest_copy_exit_10_words$
+		blo memory_fastest_copy_exit_10_words$
 		subs size, #40  			// four bytes per word, 10 word registers = 40 bytes copied in each iteration.
 		ldmia src!, {r3-r12}		// Loading 10 words at a time (Load - Full Ascending Stack - Increase After).
 		stmia dest!, {r3-r12}		// Storing 10 words at a time (Store - Full Ascending Stack - Increase After).
@@ -39,7 +39,7 @@ memory_fastest_copy:
 	// Copies 1 word at a time (4 bytes).
 	memory_fastest_copy_while_1_word$:
 		cmp size, #4				// Making sure that the number of bytes to copy are more or equals to 4 bytes.
-		bls memory_fastest_copy_exit_1_word$
+		blo memory_fastest_copy_exit_1_word$
 		subs size, #4				// Subtracting the number of bytes copied.
 		ldmia src!, {r3}			// Loading 1 word at a time (Load - Full Ascending Stack - Increase After).
 		stmia dest!, {r3}			// Storing 1 word at a time (Store - Full Ascending Stack - Increase After).
@@ -49,7 +49,7 @@ memory_fastest_copy:
 	// Copies 1 byte at a time.
 	memory_fastest_copy_while_1_byte$:
 		cmp size, #1
-		bls memory_fastest_copy_exit_1_byte$
+		blo memory_fastest_copy_exit_1_byte$
 		subs size, #1				// Subtracting the number of bytes copied.
 		ldrb r3, [src], #1			// Post index mem[base] -> base = base + offset (ldrb r0, [r1] #4)
 		strb r3, [dest], #1			// Post index mem[base] -> base = base + offset (strb r0, [r1] #4)
@@ -93,3 +93,40 @@ memory_fast_copy:
 	ldmfd sp!, {r4-r12,pc}			// Restoring the stack frame.
 /* Ends of memory_fast_copy. */
 
+
+
+/* Fills "size" bytes at dest with zeros. It does this by clearing 8 registers (r2 to r9) and
+ * storing all of them with a single stmia, in this way, during every iteration 32 bytes are
+ * written (8 words * 4 bytes = 32).
+ *
+ * Note: dest has to be word aligned and size has to be a multiple of 32 (e.g. a page).
+ * void memory_fast_zero(char *dest, int size)
+ */
+.globl memory_fast_zero
+memory_fast_zero:
+	stmfd sp!, {r4-r9,lr}			// Saving the stack frame.
+
+	dest .req r0				// Defining variables to be used.
+	size .req r1
+
+	mov r2, #0					// Registers used as the source of the zeros.
+	mov r3, #0
+	mov r4, #0
+	mov r5, #0
+	mov r6, #0
+	mov r7, #0
+	mov r8, #0
+	mov r9, #0
+
+	cmp size, #0
+	ble memory_fast_zero_exit$
+	memory_fast_zero_while$:
+		stmia dest!, {r2-r9}		// Storing 8 words at a time (32 bytes).
+		subs size, #32
+		bgt memory_fast_zero_while$
+	memory_fast_zero_exit$:
+
+	.unreq dest
+	.unreq size
+	ldmfd sp!, {r4-r9,pc}			// Restoring the stack frame.
+/* Ends of memory_fast_zero. */
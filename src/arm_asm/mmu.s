@@ -0,0 +1,218 @@
+/************************************************************************************
+*	mmu.s
+*
+*	Defines the functions that configure the MMU (Memory Management Unit) and the
+*   caches of the ARM1176JZF-S through the system control coprocessor (CP15).
+*
+*   The ARM1176JZF-S has a 16 KB instruction cache and a 16 KB data cache with lines
+*   of 32 bytes. The data cache can only be enabled together with the MMU, because the
+*   memory type (cacheable or not) of every address comes from the translation table.
+*
+*   It also provides the cache maintenance functions used for the memory that is shared
+*   with the GPU (VideoCore), which doesn't see the contents of the data cache.
+*
+*************************************************************************************/
+
+.section .text
+
+/*
+* Enables the MMU, the instruction and data caches and the branch prediction, using the
+* first level translation table given in r0 (16 KB aligned).
+*
+*  - Invalidates the caches and the TLB, because their contents are unknown after reset.
+*  - TTBCR = 2, so TTBR0 translates the first 1 GB (the part that changes with the process) and
+*    TTBR1 the rest. Both start with the same table; the kernel table is used as the TTBR0 table
+*    by the kernel threads (only its first 1024 entries are used).
+*  - ASID (Context ID) = 0, reserved for the kernel.
+*  - Domain 0 is a client domain, so the access permissions of the table are checked.
+*  - Sets the XP bit (ARMv6 translation table format, subpages disabled).
+*
+* Signature:	void mmu_enable(uint32_t *translation_table)
+*/
+.globl mmu_enable
+mmu_enable:
+	mov r1, #0
+	mcr p15, 0, r1, c7, c7, 0		// Invalidates the instruction and data caches.
+	mcr p15, 0, r1, c8, c7, 0		// Invalidates the unified TLB.
+	mcr p15, 0, r1, c7, c10, 4		// Data Synchronization Barrier.
+
+	mcr p15, 0, r1, c13, c0, 1		// CONTEXTIDR = 0 (ASID 0).
+	mov r1, #2
+	mcr p15, 0, r1, c2, c0, 2		// TTBCR = 2 (Translation Table Base Control Register).
+	mcr p15, 0, r0, c2, c0, 0		// TTBR0 = translation table. Table walks are not cached.
+	mcr p15, 0, r0, c2, c0, 1		// TTBR1 = translation table.
+
+	mov r1, #0x1					// Domain 0: client (the access permissions are checked).
+	mcr p15, 0, r1, c3, c0, 0		// DACR (Domain Access Control Register).
+
+	mrc p15, 0, r1, c1, c0, 0		// Reads the Control Register.
+	orr r1, r1, #0x1				// M: MMU enabled.
+	orr r1, r1, #0x4				// C: Data cache enabled.
+	orr r1, r1, #0x1800				// Z: Branch prediction enabled. I: Instruction cache enabled.
+	orr r1, r1, #0x800000			// XP: ARMv6 translation table format.
+	mcr p15, 0, r1, c1, c0, 0		// Writes the Control Register.
+
+	mov r1, #0
+	mcr p15, 0, r1, c7, c5, 4		// Flush Prefetch Buffer, so the next instructions are translated.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Invalidates the entire unified TLB, the branch target cache and the prefetch buffer. It has to be
+* called after a translation table entry is modified (and cleaned from the data cache).
+*
+* Signature:	void mmu_invalidate_tlb(void)
+*/
+.globl mmu_invalidate_tlb
+mmu_invalidate_tlb:
+	mov r0, #0
+	mcr p15, 0, r0, c7, c10, 4		// Data Synchronization Barrier (the table update is done).
+	mcr p15, 0, r0, c8, c7, 0		// Invalidates the unified TLB.
+	mcr p15, 0, r0, c7, c5, 6		// Flushes the branch target cache.
+	mcr p15, 0, r0, c7, c5, 4		// Flush Prefetch Buffer.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Switches the first level table used for the first 1 GB (TTBR0) and the ASID (Address Space ID)
+* that tags the new TLB entries. The TLB is not invalidated: the entries of the other address
+* spaces are tagged with their own ASIDs and the kernel entries are global.
+*
+* The ASID is set to 0 (reserved) while TTBR0 changes, so no entry is loaded into the TLB with
+* the new ASID using the old table, or the other way around.
+*
+* Signature:	void mmu_switch_address_space(uint32_t *table, uint32_t asid)
+*/
+.globl mmu_switch_address_space
+mmu_switch_address_space:
+	mov r2, #0
+	mcr p15, 0, r2, c13, c0, 1		// CONTEXTIDR = 0 (reserved ASID).
+	mcr p15, 0, r2, c7, c5, 4		// Flush Prefetch Buffer.
+	mcr p15, 0, r0, c2, c0, 0		// TTBR0 = table.
+	mcr p15, 0, r2, c7, c5, 4		// Flush Prefetch Buffer.
+	mcr p15, 0, r1, c13, c0, 1		// CONTEXTIDR = asid.
+	mcr p15, 0, r2, c7, c5, 6		// Flushes the branch target cache (it uses virtual addresses).
+	mcr p15, 0, r2, c7, c5, 4		// Flush Prefetch Buffer.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Invalidates the TLB entry of one page of one address space. r0 has the virtual address of the
+* page in the bits [31:12] and the ASID in the bits [7:0].
+*
+* Signature:	void mmu_invalidate_tlb_entry(uint32_t mva_asid)
+*/
+.globl mmu_invalidate_tlb_entry
+mmu_invalidate_tlb_entry:
+	mov r1, #0
+	mcr p15, 0, r1, c7, c10, 4		// Data Synchronization Barrier (the table update is done).
+	mcr p15, 0, r0, c8, c7, 1		// Invalidates the unified TLB entry (MVA and ASID).
+	mcr p15, 0, r1, c7, c5, 6		// Flushes the branch target cache.
+	mcr p15, 0, r1, c7, c5, 4		// Flush Prefetch Buffer.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Invalidates all the non global TLB entries tagged with the ASID given in r0 (bits [7:0]). It is
+* used when many pages of one address space change at once.
+*
+* Signature:	void mmu_invalidate_tlb_asid(uint32_t asid)
+*/
+.globl mmu_invalidate_tlb_asid
+mmu_invalidate_tlb_asid:
+	mov r1, #0
+	mcr p15, 0, r1, c7, c10, 4		// Data Synchronization Barrier (the table update is done).
+	mcr p15, 0, r0, c8, c7, 2		// Invalidates the unified TLB entries (ASID).
+	mcr p15, 0, r1, c7, c5, 6		// Flushes the branch target cache.
+	mcr p15, 0, r1, c7, c5, 4		// Flush Prefetch Buffer.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Cleans the data cache line that contains the address in r0, that is, writes it to memory if it
+* is dirty. The translation table walks don't look into the data cache, so every modified entry
+* has to be cleaned.
+*
+* Signature:	void cache_clean_line(void *address)
+*/
+.globl cache_clean_line
+cache_clean_line:
+	mcr p15, 0, r0, c7, c10, 1		// Clean data cache line (MVA).
+	mov r0, #0
+	mcr p15, 0, r0, c7, c10, 4		// Data Synchronization Barrier.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Cleans and invalidates the entire data cache: every dirty line is written to memory and then
+* all the lines are discarded.
+*
+* Signature:	void cache_clean_invalidate_all(void)
+*/
+.globl cache_clean_invalidate_all
+cache_clean_invalidate_all:
+	mov r0, #0
+	mcr p15, 0, r0, c7, c14, 0		// Clean and invalidate entire data cache.
+	mcr p15, 0, r0, c7, c10, 4		// Data Synchronization Barrier.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Cleans the data cache lines that contain the "size" bytes starting at "start", that is, writes
+* them to memory if they are dirty. It has to be called after the CPU writes memory that another
+* bus master (the GPU) is going to read.
+*
+* Signature:	void cache_clean_range(const void *start, size_t size)
+*/
+.globl cache_clean_range
+cache_clean_range:
+	add r1, r0, r1					// r1 = end of the range (not included).
+	bic r0, r0, #31					// Start of the first cache line (32 bytes).
+	cache_clean_range_while$:
+		cmp r0, r1
+		bhs cache_clean_range_exit$
+		mcr p15, 0, r0, c7, c10, 1	// Clean data cache line (MVA).
+		add r0, r0, #32
+		b cache_clean_range_while$
+	cache_clean_range_exit$:
+
+	mov r0, #0
+	mcr p15, 0, r0, c7, c10, 4		// Data Synchronization Barrier.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Invalidates the data cache lines that contain the "size" bytes starting at "start", so the next
+* reads come from memory. It has to be called before the CPU reads memory that another bus master
+* (the GPU) wrote.
+*
+* The lines that are only partially inside the range are cleaned and invalidated instead, so the
+* bytes outside the range that share them are not lost. Buffers written by the GPU should be
+* aligned to 32 bytes, otherwise those bytes would be written back over the GPU's data.
+*
+* Signature:	void cache_invalidate_range(void *start, size_t size)
+*/
+.globl cache_invalidate_range
+cache_invalidate_range:
+	add r1, r0, r1					// r1 = end of the range (not included).
+
+	tst r0, #31						// Is the first line partially inside the range?
+	bic r0, r0, #31
+	mcrne p15, 0, r0, c7, c14, 1	// Clean and invalidate data cache line (MVA).
+	addne r0, r0, #32
+
+	tst r1, #31						// Is the last line partially inside the range?
+	bic r2, r1, #31					// r2 = end of the lines fully inside the range.
+	mcrne p15, 0, r2, c7, c14, 1	// Clean and invalidate data cache line (MVA).
+
+	cache_invalidate_range_while$:
+		cmp r0, r2
+		bhs cache_invalidate_range_exit$
+		mcr p15, 0, r0, c7, c6, 1	// Invalidate data cache line (MVA).
+		add r0, r0, #32
+		b cache_invalidate_range_while$
+	cache_invalidate_range_exit$:
+
+	mov r0, #0
+	mcr p15, 0, r0, c7, c10, 4		// Data Synchronization Barrier.
+	mov pc, lr						// Returning to the caller.
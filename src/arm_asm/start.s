@@ -25,13 +25,13 @@ _start:
     ldr pc, irq_handler				// IRQ
     ldr pc, fiq_handler				// FIQ
 reset_handler:      .word reset
-undefined_handler:  .word hang
+undefined_handler:  .word undefined_handler_int	// undefined_handler_int() is defined in interruptsHandlers.s
 swi_handler:        .word swi_handler_int		// swi_handler_int() is defined in interruptsHandlers.s
 prefetch_handler:   .word hang
-data_handler:       .word hang
+data_handler:       .word data_abort_handler_int	// data_abort_handler_int() is defined in interruptsHandlers.s
 unused_handler:     .word hang
 irq_handler:        .word irq_handler_int
-fiq_handler:        .word hang
+fiq_handler:        .word fiq_handler_int		// fiq_handler_int() is defined in interruptsHandlers.s
 
 /*******************************************************************************************
 * reset() function
@@ -55,6 +55,16 @@ reset:
     msr cpsr_c, r0
     mov sp, #0x8000         		// Setting the stack for IRQ Mode.
 
+/* Set stack for the Abort mode (data aborts), below the IRQ stack. */
+    mov r0, #0xD7				// Disabling FIQ, IRQ and setting the Abort Mode.
+    msr cpsr_c, r0
+    mov sp, #0x4000         		// Setting the stack for Abort Mode.
+
+/* Set stack for the Undefined mode (VFP traps), below the Abort stack. */
+    mov r0, #0xDB				// Disabling FIQ, IRQ and setting the Undefined Mode.
+    msr cpsr_c, r0
+    mov sp, #0x3000         		// Setting the stack for Undefined Mode.
+
 /*
 * Set stack for the SVC mode and disable the FIQ and IRQ interrupts.
 *
@@ -69,6 +79,17 @@ reset:
     								// thread_init() for more info. We are assuming that the kernel
     								// code is below #Ox40000
     								// The stack grows downwards and it is a full descending one.
+
+/*
+* Enable the MMU and the caches before anything else runs, so the whole kernel runs cached.
+* mmu_init() is defined in threads/mmu.c. It builds an identity mapping, so the addresses
+* don't change when the MMU is turned on.
+*/
+    bl mmu_init
+
+/* Give access to the VFP, disabled until the first floating point instruction of a thread.
+* vfp_enable_access() is defined in vfp.s. */
+    bl vfp_enable_access
     bl main
 
 /************************************************************************************************
@@ -0,0 +1,72 @@
+/************************************************************************************
+*	vfp.s
+*
+*	Defines the functions that enable the VFP (floating point unit) of the ARM1176JZF-S
+*   and save and restore its registers. The lazy switching is done in threads/vfp.c.
+*
+*************************************************************************************/
+
+.fpu vfp
+
+.section .text
+
+/* FPEXC bit that enables the VFP. */
+.equ FPEXC_EN, 0x40000000
+
+/*
+* Gives full access to the coprocessors 10 and 11 (the VFP) and leaves the VFP disabled, so the
+* first floating point instruction is trapped. It is called by start.s before any C code runs.
+*
+* Signature:	void vfp_enable_access(void)
+*/
+.globl vfp_enable_access
+vfp_enable_access:
+	mrc p15, 0, r0, c1, c0, 2		// Reads the CPACR (Coprocessor Access Control Register).
+	orr r0, r0, #0xf00000			// CP10 and CP11: full access.
+	mcr p15, 0, r0, c1, c0, 2
+	mov r0, #0
+	mcr p15, 0, r0, c7, c5, 4		// Flush Prefetch Buffer, so the new access is used.
+	fmxr fpexc, r0					// FPEXC = 0: VFP disabled.
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Enables (FPEXC.EN = 1) or disables the VFP. While it is disabled, every VFP instruction is an
+* undefined instruction.
+*
+* Signature:	void vfp_set_enabled(bool enabled)
+*/
+.globl vfp_set_enabled
+vfp_set_enabled:
+	cmp r0, #0
+	movne r0, #FPEXC_EN
+	fmxr fpexc, r0
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Saves the VFP registers (d0-d15 and FPSCR) in a struct vfp_state (threads/vfp.h). The VFP has
+* to be enabled.
+*
+* Signature:	void vfp_save(struct vfp_state *state)
+*/
+.globl vfp_save
+vfp_save:
+	fstmiad r0!, {d0-d15}
+	fmrx r1, fpscr
+	str r1, [r0]
+	mov pc, lr						// Returning to the caller.
+
+
+/*
+* Loads the VFP registers (d0-d15 and FPSCR) from a struct vfp_state (threads/vfp.h). The VFP has
+* to be enabled.
+*
+* Signature:	void vfp_restore(const struct vfp_state *state)
+*/
+.globl vfp_restore
+vfp_restore:
+	fldmiad r0!, {d0-d15}
+	ldr r1, [r0]
+	fmxr fpscr, r1
+	mov pc, lr						// Returning to the caller.
@@ -18,6 +18,8 @@
 #ifndef DEVICES_BCM2835_H_
 #define DEVICES_BCM2835_H_
 
+#include <stdint.h>
+
 /**************************************************************************************
  * ARM physical memory mapping of BCM2835 peripherals                                 *
  *                                                                                    *
@@ -33,18 +35,38 @@
 /* Interrupt controller (for ARM) */
 #define INTERRUPT_CONTROLLER_BASE (PERIPHERALS_BASE + 0xB000)
 
+/* Interrupt controller (for ARM) -  Basic pending: ARM specific IRQs (bits 0-7), "pending
+   register 1/2 has bits set" (bits 8-9) and shortcuts to some GPU IRQs (bits 10-20) */
+#define INTERRUPT_REGISTER_PENDING_BASIC (INTERRUPT_CONTROLLER_BASE + 0x200)
+
 /* Interrupt controller (for ARM) -  Pending IRQs in the range 0-31 */
 #define INTERRUPT_REGISTER_PENDING_IRQ_0_31 (INTERRUPT_CONTROLLER_BASE + 0x204)
 
 /* Interrupt controller (for ARM) -  Pending IRQs in the range 32-63 */
 #define INTERRUPT_REGISTER_PENDING_IRQ_32_63 (INTERRUPT_CONTROLLER_BASE + 0x208)
 
+/* Interrupt controller (for ARM) -  FIQ control: source routed to the FIQ (bits 0-6, same numbers
+   as the IRQs) and enable (bit 7) */
+#define INTERRUPT_REGISTER_FIQ_CONTROL (INTERRUPT_CONTROLLER_BASE + 0x20C)
+
 /* Interrupt controller (for ARM) -  Enable IRQs in the range 0-31 */
 #define INTERRUPT_REGISTER_ENABLE_IRQ_0_31 (INTERRUPT_CONTROLLER_BASE + 0x210)
 
 /* Interrupt controller (for ARM) -  Enable IRQs in the range 32-63 */
 #define INTERRUPT_REGISTER_ENABLE_IRQ_32_63 (INTERRUPT_CONTROLLER_BASE + 0x214)
 
+/* Interrupt controller (for ARM) -  Enable the ARM specific IRQs (64-71) */
+#define INTERRUPT_REGISTER_ENABLE_BASIC_IRQ (INTERRUPT_CONTROLLER_BASE + 0x218)
+
+/* Interrupt controller (for ARM) -  Disable IRQs in the range 0-31 */
+#define INTERRUPT_REGISTER_DISABLE_IRQ_0_31 (INTERRUPT_CONTROLLER_BASE + 0x21C)
+
+/* Interrupt controller (for ARM) -  Disable IRQs in the range 32-63 */
+#define INTERRUPT_REGISTER_DISABLE_IRQ_32_63 (INTERRUPT_CONTROLLER_BASE + 0x220)
+
+/* Interrupt controller (for ARM) -  Disable the ARM specific IRQs (64-71) */
+#define INTERRUPT_REGISTER_DISABLE_BASIC_IRQ (INTERRUPT_CONTROLLER_BASE + 0x224)
+
 /* Mailbox */
 #define MAILBOX_REGISTERS_BASE (PERIPHERALS_BASE + 0xB880)
 
@@ -58,6 +80,17 @@
 #define SDHCI_REGISTERS_BASE (PERIPHERALS_BASE + 0x300000)
 
 
+/* Reads and writes a 32 bits peripheral register. The accesses are volatile, so they are done once
+   and in program order; a write is a single store, never a read-modify-write. */
+static inline uint32_t mmio_read(uint32_t address) {
+  return *(volatile uint32_t *) address;
+}
+
+static inline void mmio_write(uint32_t address, uint32_t value) {
+  *(volatile uint32_t *) address = value;
+}
+
+
 /***************************************************************************
 * IRQ lines of selected BCM2835 peripherals. Note about the numbering      *
 * used here: IRQs 0-63 are those shared between the GPU and CPU, whereas   *
@@ -71,4 +104,14 @@
 #define IRQ_2 2         // IRQ line for the system timer compare register 2 (used by the GPU)
 #define IRQ_3 3         // IRQ line for the system timer compare register 3
 
+/* ARM specific IRQs (bits 0-7 of the basic pending register). */
+#define IRQ_ARM_TIMER 64            // ARM timer
+#define IRQ_ARM_MAILBOX 65          // ARM mailbox
+#define IRQ_ARM_DOORBELL_0 66       // ARM doorbell 0
+#define IRQ_ARM_DOORBELL_1 67       // ARM doorbell 1
+#define IRQ_GPU0_HALTED 68          // GPU0 halted (or GPU1 halted if bit 10 of the control register is set)
+#define IRQ_GPU1_HALTED 69          // GPU1 halted
+#define IRQ_ILLEGAL_ACCESS_1 70     // Illegal access type 1
+#define IRQ_ILLEGAL_ACCESS_0 71     // Illegal access type 0
+
 #endif /* DEVICES_BCM2835_H_ */
@@ -8,6 +8,7 @@
 #include "framebuffer.h"
 #include "gpio.h"
 #include "screen.h"
+#include "../threads/mmu.h"
 
 /* Function defined in frameBufferInfo.s. */
 extern struct framebuffer_info *
@@ -33,5 +34,11 @@ void framebuffer_init() {
       while(true);      /* Hang forever due there is an error. */
   }
 
+  /* The GPU reads the frame buffer from memory, so the CPU can't keep the pixels in its
+   * data cache. Mapping it as write-combining still lets the write buffer merge the stores
+   * of the drawing code into bursts. */
+  mmu_set_memory_type(framebuffer->gpu_pointer, framebuffer->gpu_size,
+      MMU_MEMORY_WRITE_COMBINE);
+
   SetGraphicsAddress(framebuffer); /* Sets the graphic address. */
 }
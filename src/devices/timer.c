@@ -23,7 +23,7 @@ static volatile struct bcm2835_system_timer_registers * const timer_registers =
         (volatile struct bcm2835_system_timer_registers*) SYSTEM_TIMER_REGISTERS_BASE;
 
 /* Timer interrupt handler. */
-static void timer_irq_handler(struct interrupts_stack_frame *stack_frame);
+static void timer_irq_handler(struct interrupts_stack_frame *stack_frame, void *dev);
 
 /* Resets the System Timer Compare register (C0-C3) )in the Timer Control/Status register. */
 static void timer_reset_timer_compare(int timer_compare);
@@ -33,7 +33,7 @@ static void timer_set_interval(int timer_compare, int milliseconds);
 
 void timer_init() {
   printf("\nInitializing timer.....");
-  interrupts_register_irq(IRQ_1, timer_irq_handler, "Timer Interrupt");
+  interrupts_register_irq(IRQ_1, timer_irq_handler, NULL, "Timer Interrupt");
   timer_set_interval(IRQ_1, TIMER_PERIODIC_INTERVAL);
 }
 
@@ -47,6 +47,19 @@ int timer_get_timestamp() {
   return timer_registers->CLO;
 }
 
+/* Returns the value of the System Timer Compare register TIMER_COMPARE (C0-C3), that is, the
+ * timestamp at which its IRQ is triggered. It is 0 for an invalid compare register.
+ */
+int timer_get_compare(int timer_compare) {
+  switch (timer_compare) {
+    case 0: return timer_registers->C0;
+    case 1: return timer_registers->C1;
+    case 2: return timer_registers->C2;
+    case 3: return timer_registers->C3;
+    default: return 0;
+  }
+}
+
 // TODO support 64 bits values
 void timer_msleep(int milliseconds) {
   // Implements busy waiting
@@ -76,7 +89,7 @@ static void timer_reset_timer_compare(int timer_compare) {
  * To receive the scheduled interrupt, the software must have previously enabled the corresponding
  * IRQ line using the BCM2835 interrupt controller.
  */
-static void timer_irq_handler(struct interrupts_stack_frame *stack_frame) {
+static void timer_irq_handler(struct interrupts_stack_frame *stack_frame, void *dev UNUSED) {
   printf("\nKernel - Timer Interrupt Handler.");
 
   // The System Timer compare has to be reseted after the timer interrupt.
@@ -6,6 +6,8 @@ void timer_init(void);
 
 int timer_get_timestamp();
 
+int timer_get_compare(int timer_compare);
+
 void timer_msleep(int milliseconds);
 
 #endif /* TIMER_H_ */
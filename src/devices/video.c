@@ -1,5 +1,6 @@
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "video.h"
 #include "framebuffer.h"
@@ -20,9 +21,9 @@ static struct screen_info screen;
 /* Pointer to the frame buffer. */
 static struct framebuffer_info *framebuffer;
 
-/* DrawCharacter renders the image for a single character given in r0 to the
-* screen, with to left corner given by (r1,r2). It is defined in drawing.s. */
-extern void DrawCharacter(char character, uint32_t x, uint32_t y);
+/* Bitmaps of the first 128 characters, 16 bytes per character: one per line, with the leftmost
+ * pixel in the least significant bit. It is defined in drawing.s. */
+extern const uint8_t font[];
 
 /*
  * DrawPixel draws a single pixel to the screen at the point in (r0,r1).
@@ -34,8 +35,14 @@ extern void DrawPixel(uint32_t x, uint32_t y);
 extern void memory_fastest_copy(char *src, char *dest, int size);
 extern int memory_fast_copy(char *src, char *dest, int length);
 
-/* Cleans the character area that starts in the position (x, y). */
-static void video_clean_character(int x, int y);
+/* Stores zeros 32 bytes at a time (SIZE has to be a multiple of 32). Defined in memoryCopy.s. */
+extern void memory_fast_zero(char *dest, int size);
+
+/* Fills with black (zero) the pixels of the lines [Y, Y + HEIGHT) of the screen. */
+static void video_clean_lines(int y, int height);
+
+/* Draws CHARACTER, over a black background, in the character area that starts in (x, y). */
+static void video_draw_character(char character, int x, int y);
 
 /* Calculates the new positions of the coords X and Y. */
 static void video_calculate_new_position();
@@ -72,13 +79,7 @@ void video_init() {
 void video_clean() {
   int black = 0;
   SetForeColour(black);
-  int row;
-  int col;
-  for (row = 0; row < screen.height; row++) {
-      for (col = 0; col < screen.width; col++) {
-          DrawPixel(col, row);
-      }
-  }
+  video_clean_lines(0, screen.height);
 
   // Setting the (x, y) to zero.
   screen.x_position = 0;
@@ -89,53 +90,88 @@ void video_clean() {
 void video_putc(char character) {
   /* Disable interrupts to lock out interrupt handlers
      that might write to the console. */
-  enum interrupts_level old_level = interrupts_disable();
+  enum interrupts_level old_level = interrupts_save();
 
   if (character == '\n') {
     video_new_line();
     //video_clean_row(screen.y_position);
   } else {
-    // Clean the font area due a previous letter might be there.
-    // TODO Review if we still need to call this method.
-    video_clean_character(screen.x_position, screen.y_position);
-    // DrawCharacter is define in drawing.s
-    DrawCharacter(character, screen.x_position, screen.y_position);
+    // The whole character area is written, so a previous letter is cleaned too.
+    video_draw_character(character, screen.x_position, screen.y_position);
     video_calculate_new_position();
   }
 
-  interrupts_set_level(old_level);
+  interrupts_restore(old_level);
 }
 
 /* Cleans the characters from the given row. */
 static void video_clean_row(int y) {
-  int row;
-  int col;
-  int foreColour = GetForeColour();
-  SetForeColour(0);
-  for (row = 0; row < screen.font_height; row++) {
-      // Cleaning the whole row.
-      for (col = 0; col < screen.width; col++) {
-          DrawPixel(col, y + row);
-      }
+  video_clean_lines(y, screen.font_height);
+}
+
+/*
+ * Fills with black (zero) the pixels of the lines [Y, Y + HEIGHT) of the screen.
+ *
+ * The lines are consecutive in the frame buffer, so they are zeroed with stores of 8 words
+ * that the write buffer sends as bursts (the frame buffer is mapped as write-combining),
+ * instead of one 16 bit store per pixel.
+ */
+static void video_clean_lines(int y, int height) {
+  int line_size = screen.width * (screen.pixel_size / BYTE);
+  char *start = (char *) framebuffer->gpu_pointer + y * line_size;
+  int size = line_size * height;
+
+  if (size % 32 == 0) {
+    memory_fast_zero(start, size);
+  } else {
+    int row;
+    int col;
+    int foreColour = GetForeColour();
+    SetForeColour(0);
+    for (row = 0; row < height; row++) {
+        for (col = 0; col < screen.width; col++) {
+            DrawPixel(col, y + row);
+        }
+    }
+    SetForeColour(foreColour);
   }
-  SetForeColour(foreColour);
 }
 
 /**
- * Cleans the character that is in the given position. After cleaning, there is a blank space
- * in the character area.
+ * Draws the character in the given position with the current fore colour, over a black
+ * background. The characters out of the font (above 0x7F) leave a blank space.
+ *
+ * Every line of the character is written with word stores of two pixels each, instead of one
+ * DrawPixel() call per pixel: a character is 8 pixels wide (16 bytes) and starts in a multiple
+ * of 8 pixels, so its lines are word aligned. The pixels of the background are written too, so
+ * the area doesn't have to be cleaned first, and the lines of the frame buffer are only written
+ * once (it is mapped as write-combining).
  */
-static void video_clean_character(int x, int y) {
+static void video_draw_character(char character, int x, int y) {
+  int line_size = screen.width * (screen.pixel_size / BYTE);
+  int char_line_words = screen.font_width * (screen.pixel_size / BYTE) / sizeof (uint32_t);
+  char *start = (char *) framebuffer->gpu_pointer + y * line_size
+      + x * (screen.pixel_size / BYTE);
+  const uint8_t *glyph = (unsigned char) character <= 0x7F
+      ? &font[(unsigned char) character * screen.font_height] : NULL;
+  uint32_t colour = GetForeColour();
+  uint32_t pixel_pairs[4];       /* Word of two pixels, indexed by their two bits of the glyph. */
   int row;
-  int col;
-  int foreColour = GetForeColour();
-  SetForeColour(0);
+  int word;
+
+  pixel_pairs[0] = 0;
+  pixel_pairs[1] = colour;        /* Left pixel, in the lower half word. */
+  pixel_pairs[2] = colour << 16;
+  pixel_pairs[3] = colour | colour << 16;
+
   for (row = 0; row < screen.font_height; row++) {
-      for (col = 0; col < screen.font_width; col++) {
-          DrawPixel(x + col, y + row);
+      uint32_t *line = (uint32_t *) (start + row * line_size);
+      uint32_t bits = glyph != NULL ? glyph[row] : 0;
+      for (word = 0; word < char_line_words; word++) {
+          line[word] = pixel_pairs[bits & 0x3];
+          bits >>= 2;
       }
   }
-  SetForeColour(foreColour);
 }
 
 /* Moves the current position (x, y) to the next row. If the row is already
@@ -0,0 +1,141 @@
+#ifndef __LIB_KERNEL_ATOMIC_H
+#define __LIB_KERNEL_ATOMIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Atomic operations and memory barriers of the ARM1176JZF-S (ARMv6K).
+
+   The operations are built with the exclusive load and store instructions: LDREX reads the word
+   and marks it in the exclusive monitor, and STREX only writes it if the monitor is still set,
+   otherwise the sequence is retried. irq_handler_int (interruptsHandlers.s) clears the monitor
+   before returning, so an update interrupted by an IRQ (and maybe by a context switch) is retried
+   with the new value. That makes them atomic with respect to the other threads and to the IRQ
+   handlers without disabling the interrupts, which is all that is needed on this single core.
+
+   They are meant for counters and flags. Anything that touches more than one word still needs a
+   lock or disabled interrupts. */
+
+/* Compiler barrier: the compiler doesn't move memory accesses across it. */
+static inline void atomic_barrier (void) {
+  asm volatile ("" : : : "memory");
+}
+
+/* Data Memory Barrier: the memory accesses before it are observed (by other bus masters, such as
+   the GPU or the DMA) before the ones after it. */
+static inline void atomic_dmb (void) {
+  asm volatile ("mcr p15, 0, %0, c7, c10, 5" : : "r" (0) : "memory");
+}
+
+/* Data Synchronization Barrier: waits until the memory accesses before it are complete. */
+static inline void atomic_dsb (void) {
+  asm volatile ("mcr p15, 0, %0, c7, c10, 4" : : "r" (0) : "memory");
+}
+
+/* Adds VALUE to the word at ADDRESS. Returns the new value. */
+static inline uint32_t atomic_add (volatile uint32_t *address, uint32_t value) {
+  uint32_t result, failed;
+
+  asm volatile (
+      "1: ldrex %0, [%2]\n"
+      "   add %0, %0, %3\n"
+      "   strex %1, %0, [%2]\n"
+      "   cmp %1, #0\n"
+      "   bne 1b"
+      : "=&r" (result), "=&r" (failed)
+      : "r" (address), "r" (value)
+      : "cc", "memory");
+
+  return result;
+}
+
+/* Subtracts VALUE from the word at ADDRESS. Returns the new value. */
+static inline uint32_t atomic_sub (volatile uint32_t *address, uint32_t value) {
+  return atomic_add (address, -value);
+}
+
+/* Sets the word at ADDRESS to DESIRED if it is EXPECTED. Returns the value it had. */
+static inline uint32_t atomic_cas (volatile uint32_t *address, uint32_t expected,
+                                   uint32_t desired) {
+  uint32_t old, failed;
+
+  asm volatile (
+      "1: ldrex %0, [%2]\n"
+      "   cmp %0, %3\n"
+      "   bne 2f\n"
+      "   strex %1, %4, [%2]\n"
+      "   cmp %1, #0\n"
+      "   bne 1b\n"
+      "2:"
+      : "=&r" (old), "=&r" (failed)
+      : "r" (address), "r" (expected), "r" (desired)
+      : "cc", "memory");
+
+  return old;
+}
+
+/* Sets the word at ADDRESS to VALUE. Returns the value it had. */
+static inline uint32_t atomic_exchange (volatile uint32_t *address, uint32_t value) {
+  uint32_t old, failed;
+
+  asm volatile (
+      "1: ldrex %0, [%2]\n"
+      "   strex %1, %3, [%2]\n"
+      "   cmp %1, #0\n"
+      "   bne 1b"
+      : "=&r" (old), "=&r" (failed)
+      : "r" (address), "r" (value)
+      : "cc", "memory");
+
+  return old;
+}
+
+/* Sets the bits of MASK in the word at ADDRESS. Returns the value it had. */
+static inline uint32_t atomic_or (volatile uint32_t *address, uint32_t mask) {
+  uint32_t old, result, failed;
+
+  asm volatile (
+      "1: ldrex %0, [%3]\n"
+      "   orr %1, %0, %4\n"
+      "   strex %2, %1, [%3]\n"
+      "   cmp %2, #0\n"
+      "   bne 1b"
+      : "=&r" (old), "=&r" (result), "=&r" (failed)
+      : "r" (address), "r" (mask)
+      : "cc", "memory");
+
+  return old;
+}
+
+/* Clears the bits of MASK in the word at ADDRESS. Returns the value it had. */
+static inline uint32_t atomic_clear (volatile uint32_t *address, uint32_t mask) {
+  uint32_t old, result, failed;
+
+  asm volatile (
+      "1: ldrex %0, [%3]\n"
+      "   bic %1, %0, %4\n"
+      "   strex %2, %1, [%3]\n"
+      "   cmp %2, #0\n"
+      "   bne 1b"
+      : "=&r" (old), "=&r" (result), "=&r" (failed)
+      : "r" (address), "r" (mask)
+      : "cc", "memory");
+
+  return old;
+}
+
+/* Sets the bit BIT (0-31) of the word at ADDRESS. Returns true if it was already set. */
+static inline bool atomic_test_and_set_bit (volatile uint32_t *address, unsigned bit) {
+  return (atomic_or (address, 1u << bit) & (1u << bit)) != 0;
+}
+
+/* Clears the bit BIT (0-31) of the word at ADDRESS. Returns true if it was set. */
+static inline bool atomic_test_and_clear_bit (volatile uint32_t *address, unsigned bit) {
+  return (atomic_clear (address, 1u << bit) & (1u << bit)) != 0;
+}
+
+/* Operations on double words (8 bytes aligned) with LDREXD and STREXD, defined in atomic.s. */
+uint64_t atomic_add_64 (volatile uint64_t *address, uint64_t value);  /* Returns the new value. */
+uint64_t atomic_read_64 (const volatile uint64_t *address);          /* Never half updated. */
+
+#endif /* lib/kernel/atomic.h */
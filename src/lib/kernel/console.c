@@ -1,3 +1,4 @@
+#include <atomic.h>
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -55,8 +56,9 @@ static bool use_console_lock;
    counter. */
 static int console_lock_depth;
 
-/* Number of characters written to console. */
-static int64_t write_cnt;
+/* Number of characters written to console. It is updated atomically: the interrupt handlers write
+   without the console lock. */
+static volatile uint64_t write_cnt;
 
 /* Enable console locking. */
 void console_init (void) {
@@ -73,7 +75,7 @@ void console_panic (void) {
 
 /* Prints console statistics. */
 void console_print_stats (void) {
-  printf ("Console: %lld characters output\n", write_cnt);
+  printf ("Console: %lld characters output\n", atomic_read_64 (&write_cnt));
 }
 
 /* Acquires the console lock. */
@@ -158,7 +160,7 @@ static void vprintf_helper (char c, void *char_cnt_) {
    appropriate. */
 static void putchar_have_lock (uint8_t c) {
   ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
+  atomic_add_64 (&write_cnt, 1);
   serial_putc (c);
   video_putc (c);
 }
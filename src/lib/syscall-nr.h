@@ -28,7 +28,11 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Scheduling and time. */
+    SYS_YIELD,                  /* Yield the CPU to another thread. */
+    SYS_TIME                    /* Read the system timer (microseconds). */
   };
 
 #endif /* lib/syscall-nr.h */
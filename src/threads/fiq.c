@@ -0,0 +1,107 @@
+/*
+ * fiq.c
+ *
+ * FIQ fast path for one latency critical interrupt source, such as a sampling device.
+ *
+ * The BCM2835 can route one of its interrupt sources (the same numbers as the IRQs, 0-71) to the
+ * FIQ instead of the IRQ. The FIQ is handled by fiq_handler_int (interruptsHandlers.s) without
+ * the C dispatcher and without saving any register: it only uses the registers r8-r14 that are
+ * banked in FIQ mode, which are set up once by fiq_enable():
+ *
+ *  - r8: data register of the device, read once per FIQ (the sample).
+ *  - r9: register written with the acknowledge value to clear the interrupt in the device, or
+ *        NULL if reading the data register clears it.
+ *  - r11: the ring.
+ *
+ * The samples are handed to the threads through a single producer (the FIQ handler), single
+ * consumer (fiq_read()) ring without locks: the handler only writes the head and the consumer
+ * only writes the tail. When the ring is full the sample is dropped and counted. The FIQ can't
+ * be masked by interrupts_disable(), so the threads can't take a lock against it.
+ *
+ * The threads and the IRQ handlers run with the FIQ enabled. The source must not be registered as
+ * an IRQ too.
+ */
+
+#include <debug.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../devices/bcm2835.h"
+#include "fiq.h"
+
+/* Bits of the FIQ control register: source (0-71) and enable. */
+#define FIQ_CONTROL_SOURCE_MASK 0x7f
+#define FIQ_CONTROL_ENABLE (1 << 7)
+
+/* Highest interrupt source that can be routed to the FIQ. */
+#define FIQ_SOURCE_MAX 71
+
+/* Ring of samples written by fiq_handler_int. The offsets of the members are used by it
+   (FIQ_RING_* in interruptsHandlers.s). */
+struct fiq_ring {
+  uint32_t head;                      /* Number of samples written (by the FIQ handler). */
+  uint32_t tail;                      /* Number of samples read (by fiq_read()). */
+  uint32_t dropped;                   /* Samples dropped because the ring was full. */
+  uint32_t ack_value;                 /* Value written to the acknowledge register. */
+  uint32_t samples[FIQ_RING_SIZE];
+};
+
+/* Functions defined in interruptsHandlers.s. */
+extern void fiq_set_registers(volatile uint32_t *data_register, volatile uint32_t *ack_register,
+    volatile struct fiq_ring *ring);
+extern void enable_fiq_interruptions();
+
+/* The ring is volatile: the FIQ handler can write it between any two accesses of fiq_read(). */
+static volatile struct fiq_ring fiq_ring;
+
+/* Routes the interrupt source IRQ_NUMBER (0-71) to the FIQ, and enables the FIQ in the current
+ * thread. On every FIQ, DATA_REGISTER is read and the value is added to the ring, and then
+ * ACK_VALUE is written to ACK_REGISTER (unless it is NULL) to clear the interrupt in the device.
+ * The ring is emptied. Only one source can be routed to the FIQ: it replaces the previous one.
+ */
+void fiq_enable(unsigned char irq_number, volatile uint32_t *data_register,
+    volatile uint32_t *ack_register, uint32_t ack_value) {
+  ASSERT(irq_number <= FIQ_SOURCE_MAX);
+  ASSERT(data_register != NULL);
+
+  fiq_disable();
+  fiq_ring.head = 0;
+  fiq_ring.tail = 0;
+  fiq_ring.dropped = 0;
+  fiq_ring.ack_value = ack_value;
+  fiq_set_registers(data_register, ack_register, &fiq_ring);
+
+  mmio_write(INTERRUPT_REGISTER_FIQ_CONTROL,
+      FIQ_CONTROL_ENABLE | (irq_number & FIQ_CONTROL_SOURCE_MASK));
+  enable_fiq_interruptions();   // enable_fiq_interruptions() is defined in interruptsHandler.s.
+}
+
+/* Stops routing the interrupt source to the FIQ. The samples in the ring can still be read. */
+void fiq_disable(void) {
+  mmio_write(INTERRUPT_REGISTER_FIQ_CONTROL, 0);
+}
+
+/* Copies to SAMPLES up to MAX samples of the ring, the oldest first, and returns how many were
+ * copied. It doesn't wait: it returns 0 if the ring is empty. It can only be called by one thread.
+ */
+size_t fiq_read(uint32_t *samples, size_t max) {
+  uint32_t tail = fiq_ring.tail;
+  uint32_t available = fiq_ring.head - tail;
+  size_t count = available < max ? available : max;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    samples[i] = fiq_ring.samples[(tail + i) & (FIQ_RING_SIZE - 1)];
+  }
+
+  /* The samples are read before the tail frees their slots (volatile accesses are not
+     reordered). */
+  fiq_ring.tail = tail + count;
+  return count;
+}
+
+/* Returns the number of samples dropped because the ring was full. */
+uint32_t fiq_dropped(void) {
+  return fiq_ring.dropped;
+}
@@ -0,0 +1,23 @@
+/*
+ * fiq.h
+ *
+ * FIQ fast path for one latency critical interrupt source. See fiq.c.
+ */
+
+#ifndef THREADS_FIQ_H_
+#define THREADS_FIQ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of samples of the FIQ ring (a power of 2). It has to be the same as FIQ_RING_SIZE in
+   interruptsHandlers.s. */
+#define FIQ_RING_SIZE 256
+
+void fiq_enable(unsigned char irq_number, volatile uint32_t *data_register,
+    volatile uint32_t *ack_register, uint32_t ack_value);
+void fiq_disable(void);
+size_t fiq_read(uint32_t *samples, size_t max);
+uint32_t fiq_dropped(void);
+
+#endif /* THREADS_FIQ_H_ */
@@ -0,0 +1,96 @@
+/*
+ * frame.c
+ *
+ * Frame table. Keeps a reference count for every page (frame) of the user pool: the number of
+ * user pages that map it. A count of 0 or 1 means that the frame has a single owner, so the
+ * pages that are not shared don't need to be registered.
+ *
+ * The counts are updated with the interrupts disabled, because mmu.c shares frames while it
+ * modifies the page tables with the interrupts off, where no lock can be taken. The frames are
+ * released with the interrupts on: the last reference frees the page.
+ */
+
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "interrupt.h"
+#include "palloc.h"
+#include "vaddr.h"
+
+/* Reference counts, indexed by the number of the frame in the user pool. The highest bit marks
+   the frames of the shared memory regions (shm.c), which stay writable in every address space
+   instead of becoming copy-on-write. */
+static uint16_t *frame_refs;
+
+#define FRAME_SHARED_MEMORY 0x8000      /* Frame of a shared memory region. */
+#define FRAME_REF_MASK      0x7fff      /* Reference count. */
+
+/* First frame and number of frames of the user pool. */
+static uint8_t *user_base;
+static size_t frame_cnt;
+
+/* Returns the reference count of the frame KPAGE. */
+static uint16_t *frame_ref(void *kpage);
+
+/* Initializes the frame table. It has to be called after palloc_init(). */
+void frame_init(void) {
+  size_t table_pages;
+
+  user_base = palloc_get_pool_base(PAL_USER, &frame_cnt);
+  table_pages = DIV_ROUND_UP(frame_cnt * sizeof *frame_refs, PGSIZE);
+  frame_refs = palloc_get_multiple(PAL_ASSERT | PAL_ZERO, table_pages);
+}
+
+/* Adds a reference to the frame KPAGE, which is going to be mapped by one more user page. */
+void frame_share(void *kpage) {
+  enum interrupts_level old_level = interrupts_disable();
+  uint16_t *ref = frame_ref(kpage);
+  uint16_t count = *ref & FRAME_REF_MASK;
+
+  ASSERT (count < FRAME_REF_MASK);
+  *ref = (*ref & FRAME_SHARED_MEMORY) | (count == 0 ? 2 : count + 1);
+  interrupts_set_level(old_level);
+}
+
+/* Returns true if the frame KPAGE is mapped by more than one user page. */
+bool frame_is_shared(void *kpage) {
+  return (*frame_ref(kpage) & FRAME_REF_MASK) > 1;
+}
+
+/* Marks the frame KPAGE as a page of a shared memory region, until it is released. */
+void frame_set_shared_memory(void *kpage) {
+  enum interrupts_level old_level = interrupts_disable();
+  *frame_ref(kpage) |= FRAME_SHARED_MEMORY;
+  interrupts_set_level(old_level);
+}
+
+/* Returns true if the frame KPAGE is a page of a shared memory region. */
+bool frame_is_shared_memory(void *kpage) {
+  return (*frame_ref(kpage) & FRAME_SHARED_MEMORY) != 0;
+}
+
+/* Removes a reference to the frame KPAGE. The last reference releases the page. */
+void frame_release(void *kpage) {
+  enum interrupts_level old_level = interrupts_disable();
+  uint16_t *ref = frame_ref(kpage);
+  uint16_t count = *ref & FRAME_REF_MASK;
+  bool last = count <= 1;
+
+  *ref = last ? 0 : (*ref & FRAME_SHARED_MEMORY) | (count - 1);
+  interrupts_set_level(old_level);
+
+  if (last) {
+    palloc_free_page(kpage);
+  }
+}
+
+/* Returns the reference count of the frame KPAGE. */
+static uint16_t *frame_ref(void *kpage) {
+  size_t index = ((uint8_t *) kpage - user_base) / PGSIZE;
+
+  ASSERT (pg_ofs(kpage) == 0);
+  ASSERT ((uint8_t *) kpage >= user_base && index < frame_cnt);
+  return &frame_refs[index];
+}
@@ -0,0 +1,20 @@
+/*
+ * frame.h
+ *
+ * Frame table: reference counts of the pages of the user pool that are mapped in more than one
+ * user address space (copy-on-write and shared memory regions).
+ */
+
+#ifndef THREADS_FRAME_H_
+#define THREADS_FRAME_H_
+
+#include <stdbool.h>
+
+void frame_init(void);
+void frame_share(void *kpage);
+bool frame_is_shared(void *kpage);
+void frame_set_shared_memory(void *kpage);
+bool frame_is_shared_memory(void *kpage);
+void frame_release(void *kpage);
+
+#endif /* THREADS_FRAME_H_ */
@@ -0,0 +1,217 @@
+/*
+ * futex.c
+ *
+ * Futexes. futex_wait() blocks the current thread only if a word of memory still has the value
+ * that the caller read, and futex_wake() wakes the threads that wait on that word. The check and
+ * the sleep are atomic with respect to futex_wake(), so a wakeup can't be lost between them.
+ *
+ * The waiting threads are kept in one queue per word, in a hash table keyed by the kernel address
+ * of the word. A user address is translated through the address space of the current thread, so
+ * the processes that map a shared memory region (shm.h) at different addresses share the queues.
+ * Queues only exist while some thread is waiting.
+ *
+ * On top of them, futex_mutex_lock() and futex_mutex_unlock() implement a mutex in a word of
+ * memory (0: unlocked, 1: locked, 2: locked with waiters). Taking or releasing a free mutex is a
+ * ldrex/strex sequence (atomic.h): it doesn't disable the interrupts, take the futex lock or call
+ * the scheduler, unlike sema_down(). Only a contended mutex goes to futex_wait() or futex_wake().
+ */
+
+#include <atomic.h>
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+
+#include "../devices/timer.h"
+#include "futex.h"
+#include "interrupt.h"
+#include "malloc.h"
+#include "mmu.h"
+#include "synch.h"
+#include "thread.h"
+
+/* Threads waiting on one word. */
+struct futex_queue {
+  struct hash_elem elem;        /* Element of the futex_queues table. */
+  uintptr_t address;            /* Kernel address of the word. */
+  struct list waiters;          /* Waiting threads, in the order they arrived. */
+};
+
+/* Queues of the addresses that have waiting threads, and lock that protects them. */
+static struct hash futex_queues;
+static struct lock futex_lock;
+
+static unsigned futex_queue_hash(const struct hash_elem *e, void *aux);
+static bool futex_queue_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
+static struct futex_queue *futex_queue_lookup(uintptr_t address);
+static uintptr_t futex_key(volatile uint32_t *address);
+
+/* Initializes the futexes. It has to be called after malloc_init(). */
+void futex_init(void) {
+  if (!hash_init(&futex_queues, futex_queue_hash, futex_queue_less, NULL)) {
+    PANIC("futex_init: out of memory");
+  }
+  lock_init(&futex_lock);
+}
+
+/* Blocks the current thread until futex_wake() is called on ADDRESS, if the word at ADDRESS has
+   the value EXPECTED. Returns false at once if it doesn't, or if there is no memory for the
+   queue. The caller has to check the word again when it returns. */
+bool futex_wait(volatile uint32_t *address, uint32_t expected) {
+  struct futex_queue *queue;
+  uintptr_t key;
+
+  ASSERT (!interrupts_context());
+
+  lock_acquire(&futex_lock);
+  if (*address != expected) {
+    lock_release(&futex_lock);
+    return false;
+  }
+
+  /* The read above mapped the page if it was reserved for demand paging. */
+  key = futex_key(address);
+  queue = futex_queue_lookup(key);
+  if (queue == NULL) {
+    queue = malloc(sizeof *queue);
+    if (queue == NULL) {
+      lock_release(&futex_lock);
+      return false;
+    }
+    queue->address = key;
+    list_init(&queue->waiters);
+    hash_insert(&futex_queues, &queue->elem);
+  }
+  list_push_back(&queue->waiters, &thread_current()->elem);
+
+  /* futex_wake() needs the futex lock, so it can't run until this thread is blocked. */
+  enum interrupts_level old_level = interrupts_disable();
+  lock_release(&futex_lock);
+  thread_block();
+  interrupts_set_level(old_level);
+
+  return true;
+}
+
+/* Wakes up to COUNT threads waiting on ADDRESS, in the order they started to wait. Returns the
+   number of threads woken. */
+int futex_wake(volatile uint32_t *address, int count) {
+  struct futex_queue *queue;
+  uintptr_t key;
+  int woken = 0;
+
+  lock_acquire(&futex_lock);
+  key = futex_key(address);
+  queue = key != 0 ? futex_queue_lookup(key) : NULL;
+  if (queue != NULL) {
+    while (woken < count && !list_empty(&queue->waiters)) {
+      thread_unblock(list_entry(list_pop_front(&queue->waiters), struct thread, elem));
+      woken++;
+    }
+    if (list_empty(&queue->waiters)) {
+      hash_delete(&futex_queues, &queue->elem);
+      free(queue);
+    }
+  }
+  lock_release(&futex_lock);
+
+  return woken;
+}
+
+/* Acquires the mutex at MUTEX, sleeping until it is free if necessary. */
+void futex_mutex_lock(volatile uint32_t *mutex) {
+  uint32_t state = atomic_cas(mutex, 0, 1);
+
+  if (state == 0) {
+    return;                     /* Fast path: it was free. */
+  }
+  if (state != 2) {
+    state = atomic_exchange(mutex, 2);
+  }
+  while (state != 0) {
+    futex_wait(mutex, 2);
+    state = atomic_exchange(mutex, 2);
+  }
+}
+
+/* Releases the mutex at MUTEX, waking one of its waiters if there are any. */
+void futex_mutex_unlock(volatile uint32_t *mutex) {
+  if (atomic_exchange(mutex, 0) == 2) {
+    futex_wake(mutex, 1);
+  }
+}
+
+/* Returns the queue of ADDRESS, or NULL if no thread waits on it. The futex lock must be held. */
+static struct futex_queue *futex_queue_lookup(uintptr_t address) {
+  struct futex_queue key;
+  struct hash_elem *e;
+
+  key.address = address;
+  e = hash_find(&futex_queues, &key.elem);
+  return e != NULL ? hash_entry(e, struct futex_queue, elem) : NULL;
+}
+
+/* Returns the kernel address of the word at ADDRESS: ADDRESS itself, because the kernel memory is
+   identity mapped, or the page that maps it if it is a user address of the current thread. Returns
+   0 if the user address is not mapped, so no thread can be waiting on it. */
+static uintptr_t futex_key(volatile uint32_t *address) {
+  struct address_space *as = thread_current()->address_space;
+
+  if (as == NULL || (uintptr_t) address < MMU_USER_BASE || (uintptr_t) address >= MMU_USER_TOP) {
+    return (uintptr_t) address;
+  }
+  return (uintptr_t) mmu_get_user_page(as, (const void *) address);
+}
+
+/* Hash function of the futex queues: their address. */
+static unsigned futex_queue_hash(const struct hash_elem *e, void *aux UNUSED) {
+  return hash_int(hash_entry(e, struct futex_queue, elem)->address);
+}
+
+/* Orders the futex queues by address. */
+static bool futex_queue_less(const struct hash_elem *a, const struct hash_elem *b,
+    void *aux UNUSED) {
+  return hash_entry(a, struct futex_queue, elem)->address
+      < hash_entry(b, struct futex_queue, elem)->address;
+}
+
+/* Number of lock/unlock pairs done by futex_benchmark(). */
+#define BENCHMARK_ROUNDS 10000
+
+/* Compares taking and releasing a free futex mutex against a struct lock and a semaphore.
+   Prints the elapsed system timer ticks (microseconds). */
+void futex_benchmark(void) {
+  volatile uint32_t mutex = 0;
+  struct semaphore sema;
+  struct lock lock;
+  int start, futex_time, lock_time, sema_time;
+  int i;
+
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++) {
+    futex_mutex_lock(&mutex);
+    futex_mutex_unlock(&mutex);
+  }
+  futex_time = timer_get_timestamp() - start;
+
+  lock_init(&lock);
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++) {
+    lock_acquire(&lock);
+    lock_release(&lock);
+  }
+  lock_time = timer_get_timestamp() - start;
+
+  sema_init(&sema, 1);
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++) {
+    sema_down(&sema);
+    sema_up(&sema);
+  }
+  sema_time = timer_get_timestamp() - start;
+
+  printf("\nFutex benchmark: %d uncontended lock/unlock pairs", BENCHMARK_ROUNDS);
+  printf("\n  futex mutex:  %d us", futex_time);
+  printf("\n  lock:         %d us", lock_time);
+  printf("\n  semaphore:    %d us", sema_time);
+}
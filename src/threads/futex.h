@@ -0,0 +1,25 @@
+/*
+ * futex.h
+ *
+ * Futexes (fast user-space mutexes): wait on and wake the threads that use a word of memory,
+ * for example in a shared memory region (shm.h), and a mutex built on them whose uncontended
+ * path is a single atomic instruction sequence. See futex.c.
+ */
+
+#ifndef THREADS_FUTEX_H_
+#define THREADS_FUTEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void futex_init(void);
+bool futex_wait(volatile uint32_t *address, uint32_t expected);
+int futex_wake(volatile uint32_t *address, int count);
+
+/* Mutex in a word of memory, initialized to 0 (unlocked). */
+void futex_mutex_lock(volatile uint32_t *mutex);
+void futex_mutex_unlock(volatile uint32_t *mutex);
+
+void futex_benchmark(void);
+
+#endif /* THREADS_FUTEX_H_ */
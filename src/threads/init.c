@@ -11,11 +11,18 @@
 #include "../devices/serial.h"
 #include "../devices/timer.h"
 #include "../devices/video.h"
+#include "frame.h"
+#include "futex.h"
 #include "interrupt.h"
 #include "init.h"
 #include "palloc.h"
 #include "malloc.h"
+#include "mmu.h"
+#include "pipe.h"
+#include "region.h"
+#include "shm.h"
 #include "synch.h"
+#include "syscall.h"
 #include "thread.h"
 #include "vaddr.h"
 
@@ -33,12 +40,16 @@ static void task_6(void *);
 static void init_all_threads();
 static struct lock lock_task;
 
+#ifdef BENCHMARKS
+static void run_benchmarks(void);
+#endif
+
 /*
 static void test_swi_interrupt() {
   unsigned short blue = 0x1f;
   unsigned short green = 0x7E0;
   SetForeColour(blue + green);
-  generate_swi_interrupt(); // Function defined in interrupts.s
+  syscall(SYS_YIELD, 0, 0, 0); // Function defined in interruptsHandlers.s
 }
 */
 
@@ -56,6 +67,7 @@ void init() {
   /* Initializes ourselves as a thread so we can use locks,
     then enable console locking. */
   thread_init();
+  vfp_init();
 
   /* Initializes the frame buffer and console. */
   framebuffer_init();
@@ -65,7 +77,10 @@ void init() {
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
+  frame_init ();
   malloc_init ();
+  futex_init ();
+  shm_init ();
 
   /* Initializes the Interrupt System. */
   interrupts_init();
@@ -79,6 +94,10 @@ void init() {
 
   printf("\nFinish booting.");
 
+#ifdef BENCHMARKS
+  run_benchmarks();
+#endif
+
   init_all_threads();
 
   int i = 0;
@@ -97,6 +116,23 @@ void init() {
   thread_exit ();
 }
 
+#ifdef BENCHMARKS
+/* Runs the benchmarks of the kernel subsystems, one after the other, before the demo threads are
+   created, so they don't compete with them (make BENCHMARKS=on). */
+static void run_benchmarks(void) {
+  malloc_benchmark();
+  region_benchmark();
+  mmu_address_space_benchmark();
+  mmu_demand_paging_benchmark();
+  mmu_clone_benchmark();
+  synch_benchmark();
+  futex_benchmark();
+  syscall_benchmark();
+  pipe_benchmark();
+  vfp_benchmark();
+}
+#endif
+
 static void init_all_threads() {
   lock_init(&lock_task);
   thread_create("Thread 0", PRI_MAX, &task_0, NULL);
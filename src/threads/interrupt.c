@@ -1,41 +1,179 @@
 /*
  * interrupts.c
  *
- * Note: By the default the FIQ interruptions will remain disabled.
+ * Note: By the default the FIQ interruptions will remain disabled, until an interrupt source is
+ * routed to the FIQ with fiq_enable() (fiq.c).
  */
 
+#include <console.h>
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "../devices/bcm2835.h"
 #include "../devices/timer.h"
 #include "flags.h"
 #include "interrupt.h"
+#include "malloc.h"
+#include "mmu.h"
+#include "synch.h"
 #include "thread.h"
+#include "vaddr.h"
 
-/* Number of BCM2853 interrupts. */
-#define IRQ_COUNT 64
+/* Number of BCM2853 interrupts: 64 shared with the GPU and 8 ARM specific ones. */
+#define IRQ_COUNT 72
+#define IRQ_BASIC_FIRST IRQ_ARM_TIMER
+
+/* Number of enable (and disable) registers of the interrupt controller: IRQs 0-31, 32-63 and the
+   ARM specific ones (64-71). The register of an IRQ is IRQ / 32 and its bit IRQ % 32. */
+#define IRQ_REGISTERS 3
+
+/* Bits of the basic pending register. */
+#define PENDING_BASIC_ARM 0xff          /* ARM specific IRQs (IRQ_BASIC_FIRST + bit). */
+#define PENDING_BASIC_REGISTER_1 (1 << 8)       /* Pending register 1 has bits set. */
+#define PENDING_BASIC_REGISTER_2 (1 << 9)       /* Pending register 2 has bits set. */
+#define PENDING_BASIC_SHORTCUTS_1 (0x1f << 10)  /* GPU IRQs 7, 9, 10, 18 and 19. */
+#define PENDING_BASIC_SHORTCUTS_2 (0x3f << 15)  /* GPU IRQs 53, 54, 55, 56, 57 and 62. */
+
+/* Fault status (DFSR bits 10 and [3:0]) of a translation fault and of a permission fault of a
+   small page. */
+#define FAULT_STATUS_MASK 0x40f
+#define FAULT_TRANSLATION_PAGE 0x7
+#define FAULT_PERMISSION_PAGE 0xf
+
+#ifdef IRQ_STATS
+/* Number of buckets of the entry latency histograms. Bucket 0 counts the latencies of 0 us and
+   bucket B > 0 those in [2^(B-1), 2^B) us; the last one also counts the longer ones. */
+#define IRQ_LATENCY_BUCKETS 16
+#endif
 
 /* Functions defined in interruptsHandlers.s. */
 extern uint32_t get_cpsr_value();
 extern void enable_irq_interruptions();
 extern void disable_irq_interruptions();
 extern void disable_fiq_interruptions();
+extern void irq_call_nested_handler(interrupts_handler_function *handler,
+    struct interrupts_stack_frame *stack_frame, void *dev);
 
-/* Interrupt handler functions for each interrupt. */
-static interrupts_handler_function *irq_handlers[IRQ_COUNT];
+/* Handler of an IRQ and the pointer passed to it. The dispatcher reads both from the same cache
+   line (the vectors are 8 bytes, and the array is aligned to the 32 bytes lines). */
+struct irq_vector {
+  interrupts_handler_function *handler;
+  void *dev;
+};
+
+/* Vector of each interrupt. The vector of a shared IRQ line calls interrupts_dispatch_chain(), with
+   the first irq_chain_entry of the line as DEV. */
+static struct irq_vector irq_vectors[IRQ_COUNT] __attribute__ ((aligned (32)));
+
+/* Handler of a shared IRQ line (see interrupts_register_shared_irq()). */
+struct irq_chain_entry {
+  interrupts_handler_function *handler;
+  void *dev;
+  struct irq_chain_entry *next;
+};
 
 /* Names for each interrupt, for debugging purposes. */
 static const char *irq_names[IRQ_COUNT];
 
-static interrupts_handler_function *swi_handler;
+/* Enable and disable registers of the interrupt controller. Writing 1 to a bit enables (or
+   disables) its IRQ, and the 0 bits have no effect, so they are never read. */
+static const uint32_t irq_enable_registers[IRQ_REGISTERS] = {
+    INTERRUPT_REGISTER_ENABLE_IRQ_0_31,
+    INTERRUPT_REGISTER_ENABLE_IRQ_32_63,
+    INTERRUPT_REGISTER_ENABLE_BASIC_IRQ };
+static const uint32_t irq_disable_registers[IRQ_REGISTERS] = {
+    INTERRUPT_REGISTER_DISABLE_IRQ_0_31,
+    INTERRUPT_REGISTER_DISABLE_IRQ_32_63,
+    INTERRUPT_REGISTER_DISABLE_BASIC_IRQ };
+
+/* Priority of each interrupt (0 to IRQ_PRIORITY_LEVELS - 1). */
+static uint8_t irq_priorities[IRQ_COUNT];
+
+/* IRQs enabled by interrupts_register_irq() or interrupts_enable_irq(), by register. */
+static uint32_t irq_enabled[IRQ_REGISTERS];
+
+/* IRQs that are not masked by interrupts_mask_all_except(), by register. */
+static uint32_t irq_allowed[IRQ_REGISTERS];
+
+/* IRQs with a priority higher than each level, by register. They are the ones that can nest over
+   a handler of that priority. */
+static uint32_t irq_nestable[IRQ_PRIORITY_LEVELS][IRQ_REGISTERS];
+
+/* IRQs that can be dispatched now, by register: all of them, or the nestable ones of the innermost
+   handler that runs with the IRQs enabled. The other enabled IRQs are disabled in the interrupt
+   controller meanwhile. */
+static const uint32_t irq_all[IRQ_REGISTERS] = { 0xffffffff, 0xffffffff, PENDING_BASIC_ARM };
+static const uint32_t *irq_unmasked;
+
+/* Nested IRQs: the handler of an IRQ with nestable IRQs runs in SYS mode with the IRQs enabled
+   (see irq_call_nested_handler in interruptsHandlers.s), so the dispatcher can be entered again.
+   Only the outermost one yields on return. */
+static uint32_t irq_nesting_depth;  /* Number of IRQ dispatchers running (more than 1 if nested). */
+static struct interrupts_stack_frame *irq_thread_frame; /* Stack frame of the interrupted thread. */
+
+/* Threaded IRQ: its bottom half runs in a kernel thread, which waits on PENDING. */
+struct irq_thread {
+  unsigned char irq_number;
+  interrupts_thread_function *bottom_half;
+  void *aux;
+  struct semaphore pending;       /* Upped by the dispatcher after the top half. */
+};
+
+/* Threaded IRQs (NULL for the rest). */
+static struct irq_thread *irq_threads[IRQ_COUNT];
+
+#ifdef IRQOFF_TRACE
+/* Interrupts off tracing (IRQOFF_TRACE, see the Makefile). The windows in which the IRQs are
+   disabled are measured from the interrupts_disable() that disables them to the
+   interrupts_enable() or interrupts_set_level() that enables them again, which can be in
+   another thread. The longest ones are kept by pair of callers. */
+#define IRQOFF_WINDOWS 16
 
-static const char *swi_name;
+/* IRQ off windows opened and closed at the same pair of callers. */
+struct irqoff_window {
+  void *disable_caller;           /* Caller that disabled the IRQs. */
+  void *enable_caller;            /* Caller that enabled them. */
+  uint32_t count;                 /* Number of windows. */
+  uint32_t max_time;              /* Longest window, in microseconds. */
+  uint64_t total_time;            /* Total time with the IRQs disabled, in microseconds. */
+};
+
+/* Pairs of callers with the longest windows (count is 0 in the free entries). */
+static struct irqoff_window irqoff_windows[IRQOFF_WINDOWS];
+
+/* Current window. It is not open if the IRQs were disabled in any other way, for example by an
+   IRQ, so a stale start is never used. */
+static bool irqoff_open;
+static uint32_t irqoff_start;
+static void *irqoff_caller;
+
+/* Adds the window that ends now, enabled from CALLER, to irqoff_windows. */
+static void interrupts_irqoff_record(void *caller);
+#endif
+
+#ifdef IRQ_STATS
+/* IRQ statistics (IRQ_STATS, see the Makefile): the dispatcher reads the system timer around each
+   handler call. Without them, it doesn't read the timer at all.
+
+   Statistics of one IRQ. The times are measured with the system timer, in microseconds. */
+struct irq_stats {
+  uint32_t count;                 /* Number of times that the handler was called. */
+  uint64_t total_time;            /* Total time spent in the handler. */
+  uint32_t max_time;              /* Longest handler call. */
+  uint32_t max_latency;           /* Longest entry latency. */
+  uint32_t latency_histogram[IRQ_LATENCY_BUCKETS];  /* Entry latencies (see IRQ_LATENCY_BUCKETS). */
+};
+
+/* Statistics of each interrupt. */
+static struct irq_stats irq_stats[IRQ_COUNT];
+#endif
 
 /* External interrupts are those generated by devices outside the CPU, such as the timer. External
-   interrupts run with interrupts turned off, so they never nest, nor are they ever pre-empted.
+   interrupts run with interrupts turned off, so they never nest, nor are they ever pre-empted,
+   unless IRQs of higher priority were set (see interrupts_set_irq_priority()).
    Handlers for external interrupts also many not sleep, although they may invoke
    interrupts_yield_on_return() to request that a new process be scheduled just before the interrupt
    returns. */
@@ -48,19 +186,46 @@ static bool yield_on_return; /* Should we yield on interrupt return? */
 /* Returns true if the IRQ number is valid, otherwise false. */
 static bool interrupts_is_valid_irq_number(unsigned char irq_number);
 
-/* Enables the given IRQ in the interrupt controller (BCM2835 SoC - System on Chip). */
-static void interrupts_enable_irq(unsigned char irq_number);
+/* Enable and disable the interrupts and return the previous level. CALLER is the address from
+   which interrupts_enable(), interrupts_disable() or interrupts_set_level() was called. */
+static inline enum interrupts_level interrupts_enable_from(void *caller);
+static inline enum interrupts_level interrupts_disable_from(void *caller);
+
+/* Writes the enable and disable registers of the interrupt controller, so only the enabled IRQs
+   of irq_unmasked and irq_allowed are enabled. */
+static void interrupts_write_unmasked(void);
+
+/* Kernel thread that runs the bottom half of a threaded IRQ. */
+static void interrupts_irq_thread(void *irq_thread_);
 
-/* Dispatches the pending IRQ. */
-static void interrupts_dispatch_pending_irq(struct interrupts_stack_frame *stack_frame, int32_t irq_number);
+/* Top half of the threaded IRQs registered without one. */
+static void no_top_half(struct interrupts_stack_frame *stack_frame UNUSED, void *dev UNUSED);
+static void interrupts_dispatch_chain(struct interrupts_stack_frame *stack_frame, void *chain);
+static void interrupts_free_chain(struct irq_chain_entry *chain);
+
+/* Dispatches the IRQs of the bits set in PENDING, which are the IRQs FIRST to FIRST + 31 of the
+   pending register PENDING_REGISTER. ENTRY_TIME is the timestamp at which the dispatcher was
+   entered. */
+static inline void interrupts_dispatch_pending(uint32_t pending_register,
+    uint32_t pending, int32_t first, uint32_t entry_time);
+
+/* Calls the handler of the IRQ. Returns true if it ran with the IRQs enabled. */
+static inline bool interrupts_call_handler(int32_t irq_number);
+
+#ifdef IRQ_STATS
+/* Adds a call to the handler of the IRQ to its statistics. */
+static inline void interrupts_account_irq(int32_t irq_number, uint32_t latency,
+    uint32_t handler_time);
+#endif
 
 /* Dummy interrupt handler. */
-static void dummy_handler(struct interrupts_stack_frame *stack_frame);
+static void dummy_handler(struct interrupts_stack_frame *stack_frame, void *dev);
 
 /*
  * Initializes the interrupt system. It assumes that the interrupts FIQ and IRQ are disabled.
  *
- * Note: By the default the FIQ interruptions will remain disabled.
+ * Note: By the default the FIQ interruptions will remain disabled, until an interrupt source is
+ * routed to the FIQ with fiq_enable() (fiq.c).
  */
 void interrupts_init(void) {
   printf("\nInitializing interrupts.....");
@@ -69,37 +234,230 @@ void interrupts_init(void) {
   was_irq_generated = false;
   in_external_interrupt = false;
   yield_on_return = false;
+  irq_nesting_depth = 0;
+  irq_unmasked = irq_all;
+  memcpy(irq_allowed, irq_all, sizeof irq_allowed);
 
-  /* Initialize irq_names and irq_handlers. */
+  /* Initialize irq_names and irq_vectors. */
   for (i = 0; i < IRQ_COUNT; i++) {
       irq_names[i] = "Unknown";
-      irq_handlers[i] = dummy_handler;
+      irq_vectors[i].handler = dummy_handler;
+      irq_vectors[i].dev = NULL;
   }
+  interrupts_reset_stats();
 
   // FIQ interrupts remain disabled.
     disable_fiq_interruptions();  // disable_fiq_interruptions() is defined in interruptsHander.s
 }
 
 /* Register the IRQ handler for the given interrupt number. The BCM2835 has 64 IRQ interruptions
- * that are enumerated from 0 to 63.
+ * shared with the GPU, enumerated from 0 to 63, and 8 ARM specific ones, enumerated from 64 to 71
+ * (see bcm2835.h). The handler is called with DEV, and replaces the handlers already registered.
  */
 void interrupts_register_irq(unsigned char irq_number, interrupts_handler_function *handler,
-    const char *name) {
+    void *dev, const char *name) {
   if (!interrupts_is_valid_irq_number(irq_number)) {
       return;
   }
 
-  irq_handlers[irq_number] = handler;
+  /* The chain of a shared line is detached with the interrupts disabled, and freed after. */
+  struct irq_chain_entry *chain = NULL;
+  enum interrupts_level old_level = interrupts_disable();
+  if (irq_vectors[irq_number].handler == interrupts_dispatch_chain) {
+      chain = irq_vectors[irq_number].dev;
+  }
+  irq_vectors[irq_number].handler = handler;
+  irq_vectors[irq_number].dev = dev;
   irq_names[irq_number] = name;
+  interrupts_set_level(old_level);
+  interrupts_free_chain(chain);
 
   // Enables the IRQ in the Interrupt Controller.
   interrupts_enable_irq(irq_number);
 }
 
-/* Register the SWI hander for the Software interrupts. */
-void interrupts_register_swi(interrupts_handler_function *handler, const char *name) {
-  swi_handler = handler;
-  swi_name = name;
+/* Adds HANDLER(DEV) to the handlers of a shared IRQ line. The first handler of a line is registered
+ * as with interrupts_register_irq(), and it is dispatched without going through the chain. When a
+ * second one is added, both are moved to a chain of irq_chain_entry, called in order by
+ * interrupts_dispatch_chain(). Returns false if the IRQ number is not valid or there is no memory.
+ */
+bool interrupts_register_shared_irq(unsigned char irq_number, interrupts_handler_function *handler,
+    void *dev, const char *name) {
+  if (!interrupts_is_valid_irq_number(irq_number)) {
+      return false;
+  }
+
+  struct irq_vector *vector = &irq_vectors[irq_number];
+  if (vector->handler == dummy_handler) {
+      interrupts_register_irq(irq_number, handler, dev, name);
+      return true;
+  }
+
+  /* Allocated with the interrupts enabled: the first entry, for the handler already registered,
+     is only needed if the line is not a chain yet. The line can change while they are allocated,
+     so it is checked again with the interrupts disabled. */
+  struct irq_chain_entry *entry = malloc(sizeof *entry);
+  struct irq_chain_entry *first = NULL;
+  if (entry == NULL) {
+      return false;
+  }
+  entry->handler = handler;
+  entry->dev = dev;
+  entry->next = NULL;
+
+  enum interrupts_level old_level = interrupts_disable();
+  while (vector->handler != interrupts_dispatch_chain && first == NULL) {
+      interrupts_set_level(old_level);
+      first = malloc(sizeof *first);
+      if (first == NULL) {
+          free(entry);
+          return false;
+      }
+      old_level = interrupts_disable();
+  }
+
+  if (vector->handler != interrupts_dispatch_chain) {
+      first->handler = vector->handler;
+      first->dev = vector->dev;
+      first->next = entry;
+      vector->handler = interrupts_dispatch_chain;
+      vector->dev = first;
+      first = NULL;
+  } else {
+      struct irq_chain_entry *last = vector->dev;
+      while (last->next != NULL) {
+          last = last->next;
+      }
+      last->next = entry;
+  }
+  interrupts_set_level(old_level);
+
+  /* Not needed if another handler made the line a chain meanwhile. */
+  free(first);
+  return true;
+}
+
+/* Registers a threaded IRQ. TOP_HALF (can be NULL) runs in the IRQ context like the handler of any
+ * other IRQ, and only has to acknowledge the interrupt in the device. Then the IRQ is masked in the
+ * interrupt controller and BOTTOM_HALF(AUX) runs in a kernel thread created for the IRQ, named
+ * NAME and with the given thread PRIORITY. The IRQ is unmasked when the bottom half returns.
+ *
+ * The processing of the device competes with the other threads in the scheduler and runs with the
+ * interrupts enabled, so it doesn't extend the time that they are disabled. The bottom half can
+ * sleep. The interrupted thread yields when the IRQ thread is woken, but the ready queue is FIFO:
+ * PRIORITY is only stored, like the priority of any thread (see thread_create()), so the IRQ
+ * thread runs after the threads that were already ready.
+ *
+ * Returns false if the IRQ number is not valid or the thread can't be created.
+ */
+bool interrupts_register_threaded_irq(unsigned char irq_number,
+    interrupts_handler_function *top_half, interrupts_thread_function *bottom_half, void *aux,
+    const char *name, int32_t priority) {
+  ASSERT(bottom_half != NULL);
+  if (!interrupts_is_valid_irq_number(irq_number) || irq_threads[irq_number] != NULL) {
+      return false;
+  }
+
+  struct irq_thread *irq_thread = malloc(sizeof *irq_thread);
+  if (irq_thread == NULL) {
+      return false;
+  }
+  irq_thread->irq_number = irq_number;
+  irq_thread->bottom_half = bottom_half;
+  irq_thread->aux = aux;
+  sema_init(&irq_thread->pending, 0);
+
+  if (thread_create(name, priority, interrupts_irq_thread, irq_thread) == TID_ERROR) {
+      free(irq_thread);
+      return false;
+  }
+  irq_threads[irq_number] = irq_thread;
+  interrupts_register_irq(irq_number, top_half != NULL ? top_half : no_top_half, aux, name);
+  return true;
+}
+
+/* Enables the given IRQ in the interrupt controller (BCM2835 SoC - System on Chip). It is only
+ * written to the controller if it is not masked (by a running handler of the same or higher
+ * priority, or by interrupts_mask_all_except()): it is enabled when they are unmasked.
+ */
+void interrupts_enable_irq(unsigned char irq_number) {
+  if (!interrupts_is_valid_irq_number(irq_number)) {
+        return;
+  }
+
+  int32_t reg = irq_number / 32;
+  uint32_t bit = 1u << (irq_number % 32);
+
+  enum interrupts_level old_level = interrupts_disable();
+  irq_enabled[reg] |= bit;
+  if (irq_unmasked[reg] & irq_allowed[reg] & bit) {
+      mmio_write(irq_enable_registers[reg], bit);
+  }
+  interrupts_set_level(old_level);
+}
+
+/* Disables the given IRQ in the interrupt controller until interrupts_enable_irq() is called. Its
+ * handler stays registered. It can be called in an IRQ handler.
+ */
+void interrupts_disable_irq(unsigned char irq_number) {
+  if (!interrupts_is_valid_irq_number(irq_number)) {
+        return;
+  }
+
+  int32_t reg = irq_number / 32;
+  uint32_t bit = 1u << (irq_number % 32);
+
+  enum interrupts_level old_level = interrupts_disable();
+  irq_enabled[reg] &= ~bit;
+  mmio_write(irq_disable_registers[reg], bit);
+  interrupts_set_level(old_level);
+}
+
+/* Masks all the IRQs but the given one in the interrupt controller, for example while a driver
+ * handles a burst of its device. The masked IRQs stay enabled: interrupts_unmask_all() enables them
+ * again in the controller, and the ones that were raised meanwhile are dispatched then.
+ */
+void interrupts_mask_all_except(unsigned char irq_number) {
+  if (!interrupts_is_valid_irq_number(irq_number)) {
+        return;
+  }
+
+  enum interrupts_level old_level = interrupts_disable();
+  memset(irq_allowed, 0, sizeof irq_allowed);
+  irq_allowed[irq_number / 32] = 1u << (irq_number % 32);
+  interrupts_write_unmasked();
+  interrupts_set_level(old_level);
+}
+
+/* Unmasks the IRQs masked by interrupts_mask_all_except(). */
+void interrupts_unmask_all(void) {
+  enum interrupts_level old_level = interrupts_disable();
+  memcpy(irq_allowed, irq_all, sizeof irq_allowed);
+  interrupts_write_unmasked();
+  interrupts_set_level(old_level);
+}
+
+/* Sets the priority (0 to IRQ_PRIORITY_LEVELS - 1) of the IRQ. The handler of an IRQ runs with the
+ * IRQs of higher priority enabled, so they nest over it and their latency doesn't depend on it.
+ * The handlers of the IRQs that have no higher priority IRQs run with the IRQs disabled, which is
+ * the case of all of them by default.
+ */
+void interrupts_set_irq_priority(unsigned char irq_number, uint8_t priority) {
+  if (!interrupts_is_valid_irq_number(irq_number) || priority >= IRQ_PRIORITY_LEVELS) {
+      return;
+  }
+
+  enum interrupts_level old_level = interrupts_disable();
+  int32_t irq, level;
+
+  irq_priorities[irq_number] = priority;
+  memset(irq_nestable, 0, sizeof irq_nestable);
+  for (irq = 0; irq < IRQ_COUNT; irq++) {
+    for (level = 0; level < irq_priorities[irq]; level++) {
+      irq_nestable[level][irq / 32] |= 1u << (irq % 32);
+    }
+  }
+  interrupts_set_level(old_level);
 }
 
 /* Return the IRQ name that correspond to the interrupt number. */
@@ -111,11 +469,6 @@ const char* interrupts_get_irq_name(unsigned char irq_number) {
   return irq_names[irq_number];
 }
 
-/* Return the SWI name. */
-const char* interrupts_get_swi_name() {
-  return swi_name;
-}
-
 /* Returns the interrupt level. */
 enum interrupts_level interrupts_get_level(void) {
   uint32_t cpsr = get_cpsr_value();  // get_cpsr_value() is defined in interruptsHandlers.s.
@@ -126,31 +479,18 @@ enum interrupts_level interrupts_get_level(void) {
 
 /* Sets the interrupts level and returns the previous one. */
 enum interrupts_level interrupts_set_level(enum interrupts_level level) {
-  return level == INTERRUPTS_ON ? interrupts_enable() : interrupts_disable();
+  void *caller = __builtin_return_address(0);
+  return level == INTERRUPTS_ON ? interrupts_enable_from(caller) : interrupts_disable_from(caller);
 }
 
 /* Enables the interrupts and returns the previous one. */
 enum interrupts_level interrupts_enable(void) {
-  enum interrupts_level old_level = interrupts_get_level();
-
-  // TODO ADD THE ASSERT (!intr_context ());
-
-  /* Enables the IRQ interrupts by setting the IRQ interrupt flag in the
-   * CPSR (Current Process Status Register). */
-  enable_irq_interruptions();   // enable_irq_interruptions() is defined in interruptsHandler.s.
-
-  return old_level;
+  return interrupts_enable_from(__builtin_return_address(0));
 }
 
 /* Disables the interrupts and returns the previous one. */
 enum interrupts_level interrupts_disable(void) {
-  enum interrupts_level old_level = interrupts_get_level();
-
-  /* Disables the IRQ interrupts by clearing the IRQ interrupt flag in the
-     CPSR (Current Process Status Register). */
-  disable_irq_interruptions();   // disable_irq_interruptions() is defined in interruptsHandler.s.
-
-  return old_level;
+  return interrupts_disable_from(__builtin_return_address(0));
 }
 
 /* Prints status of the interrupts. */
@@ -173,6 +513,103 @@ void interrupts_print_status(void) {
   }
 }
 
+/* Prints the statistics of the IRQs that were dispatched at least once since the last
+ * interrupts_reset_stats(): number of calls, total, average and maximum handler time, maximum
+ * entry latency and the non empty buckets of the entry latency histogram. The times are in
+ * microseconds.
+ *
+ * The entry latency of the system timer IRQs (IRQ_0 to IRQ_3) is measured from the timestamp of
+ * their compare register, so it includes the time that the IRQs were disabled. For the rest of
+ * the IRQs, whose raise time is unknown, it is measured from the entry to the IRQ dispatcher, so
+ * it only includes the time spent in the handlers dispatched before them. The handler time of an
+ * IRQ that runs with the IRQs enabled includes the handlers nested over it. Only available with
+ * IRQ_STATS.
+ */
+void interrupts_print_stats(void) {
+#ifdef IRQ_STATS
+  int32_t irq, bucket;
+
+  printf("\nIRQ stats (us):");
+  for (irq = 0; irq < IRQ_COUNT; irq++) {
+    const struct irq_stats *stats = &irq_stats[irq];
+    if (stats->count == 0) {
+      continue;
+    }
+
+    printf("\n%d %s: %u calls, time %llu total %llu avg %u max, latency %u max", irq,
+        irq_names[irq], (unsigned) stats->count, stats->total_time,
+        stats->total_time / stats->count, (unsigned) stats->max_time,
+        (unsigned) stats->max_latency);
+    printf("\n  latency histogram:");
+    for (bucket = 0; bucket < IRQ_LATENCY_BUCKETS; bucket++) {
+      if (stats->latency_histogram[bucket] == 0) {
+        continue;
+      }
+      if (bucket < IRQ_LATENCY_BUCKETS - 1) {
+        printf(" <%u:%u", 1u << bucket, (unsigned) stats->latency_histogram[bucket]);
+      } else {
+        printf(" >=%u:%u", 1u << (bucket - 1), (unsigned) stats->latency_histogram[bucket]);
+      }
+    }
+  }
+#else
+  printf("\nIRQ statistics are disabled. Build with \"make IRQ_STATS=on\".");
+#endif
+}
+
+/* Prints the pairs of callers (the one that disabled the IRQs and the one that enabled them
+ * again) with the longest windows with the IRQs disabled since the last interrupts_reset_irqoff(),
+ * the longest first: number of windows, longest and total time, in microseconds. The addresses can
+ * be found in the map file of the kernel (see the Makefile). Only available with IRQOFF_TRACE.
+ */
+void interrupts_print_irqoff(void) {
+#ifdef IRQOFF_TRACE
+  bool printed[IRQOFF_WINDOWS] = { false };
+  int32_t i, rank;
+
+  printf("\nIRQ off windows (us):");
+  for (rank = 0; rank < IRQOFF_WINDOWS; rank++) {
+    int32_t longest = -1;
+
+    for (i = 0; i < IRQOFF_WINDOWS; i++) {
+      if (!printed[i] && irqoff_windows[i].count > 0
+          && (longest < 0 || irqoff_windows[i].max_time > irqoff_windows[longest].max_time)) {
+        longest = i;
+      }
+    }
+    if (longest < 0) {
+      break;
+    }
+
+    const struct irqoff_window *window = &irqoff_windows[longest];
+    printed[longest] = true;
+    printf("\n%p -> %p: %u windows, %u max, %llu total", window->disable_caller,
+        window->enable_caller, (unsigned) window->count, (unsigned) window->max_time,
+        window->total_time);
+  }
+#else
+  printf("\nIRQ off tracing is disabled. Build with \"make IRQOFF_TRACE=on\".");
+#endif
+}
+
+/* Clears the IRQ off windows. */
+void interrupts_reset_irqoff(void) {
+#ifdef IRQOFF_TRACE
+  enum interrupts_level old_level = interrupts_disable();
+  memset(irqoff_windows, 0, sizeof irqoff_windows);
+  interrupts_set_level(old_level);
+#endif
+}
+
+/* Clears the statistics of all the IRQs. */
+void interrupts_reset_stats(void) {
+#ifdef IRQ_STATS
+  enum interrupts_level old_level = interrupts_disable();
+  memset(irq_stats, 0, sizeof irq_stats);
+  interrupts_set_level(old_level);
+#endif
+}
+
 /* Returns true during processing of an external interrupt and false at all other times. */
 bool interrupts_context(void) {
   return in_external_interrupt;
@@ -197,49 +634,67 @@ void interrupts_yield_on_return (void) {
  * Dispatches the IRQ interrupt requests. Every time that an interrupt happens, a bit that refers
  * to the specify interrupt number is marked in the interrupts register indicating that that
  * interrupt was triggered.
+ *
+ * The basic pending register is read first: it has the ARM specific IRQs and tells which of the
+ * two GPU pending registers have to be read (bits 8 and 9, plus the shortcut bits of some GPU
+ * IRQs that don't set them). Each register is read once, and only its set bits are visited,
+ * using CLZ (count leading zeros) to find the highest one.
+ *
+ * With IRQ_STATS, the calls to the handlers are accounted in the IRQ statistics (see
+ * interrupts_print_stats()).
+ *
+ * The handler of an IRQ with nestable IRQs (of higher priority, see interrupts_set_irq_priority())
+ * runs with only those enabled in the interrupt controller and the IRQs enabled in the CPU, so
+ * this dispatcher can be entered again. The nested dispatchers only dispatch the unmasked IRQs,
+ * and don't yield: the outermost one does, with the stack frame of the interrupted thread, which
+ * is also the one given to all the handlers.
  * */
-void interrupts_dispatch_irq(struct interrupts_stack_frame *stack_frame) {;
-  unsigned short blue = 0x1f;
-  int32_t foreColour = GetForeColour();
-  SetForeColour(blue);
-  printf("\nKERNEL TAKING OVER - Dispatching IRQ");
-
+void interrupts_dispatch_irq(struct interrupts_stack_frame *stack_frame) {
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off).
      An external interrupt handler cannot sleep.
    */
   ASSERT(interrupts_get_level() == INTERRUPTS_OFF);
-  ASSERT(!interrupts_context());
-  ASSERT(!interrupts_was_irq_generated());
-
-  was_irq_generated = true;
-  in_external_interrupt = true; /* In external interrupt context. */
-  yield_on_return = false;
+  if (irq_nesting_depth++ == 0) {
+    ASSERT(!interrupts_context());
+    ASSERT(!interrupts_was_irq_generated());
 
-  int32_t i;
-  // First half of the pending interrupts (0-31)
-  int32_t *interrupt_ptr = (int32_t *) INTERRUPT_REGISTER_PENDING_IRQ_0_31;
-  for (i = 0; i < IRQ_COUNT / 2; i++) {
-      bool enable = *interrupt_ptr & (1 << i);
-      if (enable) {
-          interrupts_dispatch_pending_irq(stack_frame, i);
-      }
+    was_irq_generated = true;
+    in_external_interrupt = true; /* In external interrupt context. */
+    yield_on_return = false;
+    irq_thread_frame = stack_frame;
+#ifdef IRQOFF_TRACE
+    irqoff_open = false;          /* The IRQs were enabled: the window (if any) is closed. */
+#endif
+  } else {
+    ASSERT(interrupts_context()); /* Nested over a handler that runs with the IRQs enabled. */
   }
 
-  // Second half of the pending interrupts (32-63)
-  interrupt_ptr = (int32_t *) INTERRUPT_REGISTER_PENDING_IRQ_32_63;
-  for (i = 0; i < IRQ_COUNT / 2; i++) {
-      bool enable = *interrupt_ptr & (1 << i);
-      if (enable) {
-          interrupts_dispatch_pending_irq(stack_frame, i);
-      }
-  }
+#ifdef IRQ_STATS
+  uint32_t entry_time = timer_get_timestamp();
+#else
+  uint32_t entry_time = 0;        /* Only used by the IRQ statistics. */
+#endif
+  uint32_t pending_basic = mmio_read(INTERRUPT_REGISTER_PENDING_BASIC);
 
-  SetForeColour(foreColour);
+  interrupts_dispatch_pending(INTERRUPT_REGISTER_PENDING_BASIC,
+      pending_basic & irq_unmasked[2], IRQ_BASIC_FIRST, entry_time);
+  if (pending_basic & (PENDING_BASIC_REGISTER_1 | PENDING_BASIC_SHORTCUTS_1)) {
+    interrupts_dispatch_pending(INTERRUPT_REGISTER_PENDING_IRQ_0_31,
+        mmio_read(INTERRUPT_REGISTER_PENDING_IRQ_0_31) & irq_unmasked[0], 0, entry_time);
+  }
+  if (pending_basic & (PENDING_BASIC_REGISTER_2 | PENDING_BASIC_SHORTCUTS_2)) {
+    interrupts_dispatch_pending(INTERRUPT_REGISTER_PENDING_IRQ_32_63,
+        mmio_read(INTERRUPT_REGISTER_PENDING_IRQ_32_63) & irq_unmasked[1], 32, entry_time);
+  }
 
   ASSERT(interrupts_get_level() == INTERRUPTS_OFF);
   ASSERT(interrupts_context());
 
+  if (--irq_nesting_depth > 0) {
+    return;   /* Returning to the handler of the outer IRQ. */
+  }
+
   in_external_interrupt = false; /* End of the interrupt context. */
   if (yield_on_return)
     thread_yield();
@@ -247,12 +702,79 @@ void interrupts_dispatch_irq(struct interrupts_stack_frame *stack_frame) {;
   was_irq_generated = false;
 }
 
-/* SWI Dispatcher
+/* Data abort handler
+ *
+ * Called by data_abort_handler_int (interruptsHandlers.s) with the fault address (FAR) and the
+ * fault status (DFSR).
  *
- * Dispatches the SWI interrupt requests.
+ * The first access to a user page reserved for demand paging, and the first write to a page
+ * shared by copy-on-write, return true: the page is mapped or copied by
+ * interrupts_resolve_data_abort() in the thread, because allocating it can sleep. An access
+ * to the guard page below a thread stack is reported as a stack overflow of that thread. Any
+ * other fault panics.
+ *
+ * The console lock is not taken: thread_current() doesn't work on the abort stack.
  */
-void interrupts_dispatch_swi(struct interrupts_stack_frame *stack_frame, int32_t swi_number) {
-  printf("\nInterrupt SWI handler: #%d", swi_number);
+bool interrupts_dispatch_data_abort(struct interrupts_stack_frame *stack_frame,
+    void *fault_address, uint32_t fault_status) {
+  if ((fault_status & FAULT_STATUS_MASK) == FAULT_TRANSLATION_PAGE
+      && !interrupts_was_irq_generated() && mmu_is_demand_fault(fault_address)) {
+    return true;
+  }
+  if ((fault_status & FAULT_STATUS_MASK) == FAULT_PERMISSION_PAGE
+      && !interrupts_was_irq_generated() && mmu_is_copy_on_write_fault(fault_address)) {
+    return true;
+  }
+
+  console_panic();
+  /* The only kernel pages unmapped one by one are the guard pages below the thread stacks. */
+  if ((fault_status & FAULT_STATUS_MASK) == FAULT_TRANSLATION_PAGE
+      && (uintptr_t) fault_address < MMU_USER_BASE) {
+    struct thread *t = thread_from_stack_guard(fault_address);
+    if (t != NULL) {
+      printf("\nStack overflow in thread %s, TID: %d", t->name, t->tid);
+    } else {
+      printf("\nStack overflow in the thread at %p, which was overwritten",
+          (uint8_t *) pg_round_down(fault_address) + PGSIZE);
+    }
+    printf("\nAccess to %p in the guard page. sp: %p, pc: %p", fault_address,
+        stack_frame->r13_sp, stack_frame->r15_pc);
+    PANIC("Stack overflow");
+  }
+
+  printf("\nData abort accessing %p. Fault status: %x, pc: %p", fault_address,
+      (unsigned) fault_status, stack_frame->r15_pc);
+  interrupts_debug(stack_frame);
+  PANIC("Data abort");
+}
+
+/* Resolves a demand paging or copy-on-write fault. It is called by data_abort_resolve
+ * (interruptsHandlers.s) in the thread that caused the fault, with its interrupts level. The
+ * faulting instruction is executed again when it returns. If there is no memory, the thread is
+ * terminated.
+ */
+void interrupts_resolve_data_abort(void *fault_address) {
+  bool resolved = mmu_is_copy_on_write_fault(fault_address)
+      ? mmu_copy_on_write(fault_address) : mmu_map_demand_page(fault_address);
+
+  if (!resolved) {
+    printf("\n%s: out of memory accessing %p", thread_name(), fault_address);
+    thread_exit();
+  }
+}
+
+/* Undefined instruction handler
+ *
+ * Called by undefined_handler_int (interruptsHandlers.s) for every undefined instruction that is
+ * not the first VFP instruction of a thread (those are handled by vfp_switch()). It includes the
+ * floating point instructions executed out of a thread, for example in an IRQ handler.
+ */
+void interrupts_dispatch_undefined(struct interrupts_stack_frame *stack_frame) {
+  console_panic();
+  printf("\nUndefined instruction %x at %p", *(uint32_t *) stack_frame->r15_pc,
+      stack_frame->r15_pc);
+  interrupts_debug(stack_frame);
+  PANIC("Undefined instruction");
 }
 
 void interrupts_debug(struct interrupts_stack_frame *stack_frame) {
@@ -276,13 +798,206 @@ void interrupts_debug(struct interrupts_stack_frame *stack_frame) {
   printf("\nr12: %d", stack_frame->r12);
 }
 
-/* Dispatches the pending IRQ. */
-static void interrupts_dispatch_pending_irq(struct interrupts_stack_frame *stack_frame, int32_t irq_number) {
-  irq_handlers[irq_number](stack_frame);
+/* Dispatches the IRQs of the bits set in PENDING, which are the IRQs FIRST to FIRST + 31 of the
+   pending register PENDING_REGISTER, from the highest to the lowest. ENTRY_TIME is the timestamp
+   at which the dispatcher was entered.
+
+   After a handler that ran with the IRQs enabled, the IRQs that are not pending anymore are
+   discarded: they were dispatched by a nested dispatcher. */
+static inline void interrupts_dispatch_pending(uint32_t pending_register,
+    uint32_t pending, int32_t first, uint32_t entry_time) {
+  while (pending != 0) {
+    int32_t bit = 31 - __builtin_clz(pending);    /* CLZ instruction. */
+    int32_t irq_number = first + bit;
+    pending &= ~(1u << bit);
+
+#ifdef IRQ_STATS
+    /* The system timer IRQs were raised when the counter reached their compare register. */
+    uint32_t raise_time = irq_number <= IRQ_3 ? (uint32_t) timer_get_compare(irq_number)
+        : entry_time;
+    uint32_t start_time = timer_get_timestamp();
+    bool nested = interrupts_call_handler(irq_number);
+    interrupts_account_irq(irq_number, start_time - raise_time,
+        timer_get_timestamp() - start_time);
+#else
+    bool nested = interrupts_call_handler(irq_number);
+#endif
+    if (nested) {
+      pending &= mmio_read(pending_register);
+    }
+  }
+}
+
+/* Calls the handler of the IRQ with the stack frame of the interrupted thread. If there are IRQs
+   of higher priority, only they are left enabled in the interrupt controller while the handler
+   runs with the IRQs enabled, and true is returned. */
+static inline bool interrupts_call_handler(int32_t irq_number) {
+  const uint32_t *nestable = irq_nestable[irq_priorities[irq_number]];
+  const uint32_t *previous = irq_unmasked;
+  const struct irq_vector *vector = &irq_vectors[irq_number];
+
+  bool nested = (nestable[0] | nestable[1] | nestable[2]) != 0;
+
+  if (!nested) {
+    vector->handler(irq_thread_frame, vector->dev);
+  } else {
+    irq_unmasked = nestable;
+    interrupts_write_unmasked();
+    irq_call_nested_handler(vector->handler, irq_thread_frame, vector->dev);
+    irq_unmasked = previous;
+    interrupts_write_unmasked();
+  }
+
+  /* Threaded IRQ: the bottom half runs in its thread, with the IRQ masked till it returns. The
+     interrupted thread yields, so the IRQ thread doesn't wait for the end of its time slice. */
+  if (irq_threads[irq_number] != NULL) {
+    interrupts_disable_irq(irq_number);
+    sema_up(&irq_threads[irq_number]->pending);
+    interrupts_yield_on_return();
+  }
+  return nested;
 }
 
+/* Kernel thread that runs the bottom half of a threaded IRQ every time that the IRQ is dispatched,
+   and then unmasks the IRQ. */
+static void interrupts_irq_thread(void *irq_thread_) {
+  struct irq_thread *irq_thread = irq_thread_;
+
+  for (;;) {
+    sema_down(&irq_thread->pending);
+    irq_thread->bottom_half(irq_thread->aux);
+    interrupts_enable_irq(irq_thread->irq_number);
+  }
+}
+
+/* Top half of the threaded IRQs registered without one. */
+static void no_top_half(struct interrupts_stack_frame *stack_frame UNUSED, void *dev UNUSED) {
+}
+
+/* Handler of the shared IRQ lines: calls the handlers of the line in order. CHAIN is the first
+   irq_chain_entry of the line. */
+static void interrupts_dispatch_chain(struct interrupts_stack_frame *stack_frame, void *chain) {
+  struct irq_chain_entry *entry;
+
+  for (entry = chain; entry != NULL; entry = entry->next) {
+    entry->handler(stack_frame, entry->dev);
+  }
+}
+
+/* Frees the entries of CHAIN, which is no longer used by any vector. It takes the malloc lock, so
+   it can't be called with the interrupts disabled. */
+static void interrupts_free_chain(struct irq_chain_entry *chain) {
+  struct irq_chain_entry *entry = chain;
+
+  while (entry != NULL) {
+    struct irq_chain_entry *next = entry->next;
+    free(entry);
+    entry = next;
+  }
+}
+
+#ifdef IRQ_STATS
+/* Adds a call to the handler of the IRQ to its statistics. LATENCY is the time from the raise of
+   the IRQ to the call of its handler and HANDLER_TIME the time spent in the handler. */
+static inline void interrupts_account_irq(int32_t irq_number, uint32_t latency,
+    uint32_t handler_time) {
+  struct irq_stats *stats = &irq_stats[irq_number];
+  int32_t bucket = latency == 0 ? 0 : 32 - __builtin_clz(latency);
+
+  stats->count++;
+  stats->total_time += handler_time;
+  if (handler_time > stats->max_time) {
+    stats->max_time = handler_time;
+  }
+  if (latency > stats->max_latency) {
+    stats->max_latency = latency;
+  }
+  stats->latency_histogram[bucket < IRQ_LATENCY_BUCKETS ? bucket : IRQ_LATENCY_BUCKETS - 1]++;
+}
+#endif
+
+/* Enables the interrupts and returns the previous level. */
+static inline enum interrupts_level interrupts_enable_from(void *caller UNUSED) {
+  enum interrupts_level old_level = interrupts_get_level();
+
+  // TODO ADD THE ASSERT (!intr_context ());
+
+#ifdef IRQOFF_TRACE
+  if (old_level == INTERRUPTS_OFF && irqoff_open) {
+    interrupts_irqoff_record(caller);
+  }
+#endif
+
+  /* Enables the IRQ interrupts by setting the IRQ interrupt flag in the
+   * CPSR (Current Process Status Register). */
+  enable_irq_interruptions();   // enable_irq_interruptions() is defined in interruptsHandler.s.
+
+  return old_level;
+}
+
+/* Disables the interrupts and returns the previous level. */
+static inline enum interrupts_level interrupts_disable_from(void *caller UNUSED) {
+  enum interrupts_level old_level = interrupts_get_level();
+
+  /* Disables the IRQ interrupts by clearing the IRQ interrupt flag in the
+     CPSR (Current Process Status Register). */
+  disable_irq_interruptions();   // disable_irq_interruptions() is defined in interruptsHandler.s.
+
+#ifdef IRQOFF_TRACE
+  if (old_level == INTERRUPTS_ON) {
+    irqoff_open = true;
+    irqoff_start = timer_get_timestamp();
+    irqoff_caller = caller;
+  }
+#endif
+
+  return old_level;
+}
+
+#ifdef IRQOFF_TRACE
+/* Adds the window that ends now, enabled from CALLER, to irqoff_windows: to the entry of its pair
+   of callers, or else to a free entry, or else replacing the entry with the shortest longest
+   window if it is shorter. It is called with the IRQs disabled. */
+static void interrupts_irqoff_record(void *caller) {
+  uint32_t time = timer_get_timestamp() - irqoff_start;
+  struct irqoff_window *window = NULL;
+  int32_t i;
+
+  irqoff_open = false;
+  for (i = 0; i < IRQOFF_WINDOWS; i++) {
+    struct irqoff_window *w = &irqoff_windows[i];
+    if (w->count > 0 && w->disable_caller == irqoff_caller && w->enable_caller == caller) {
+      window = w;
+      break;
+    }
+    if (window == NULL || w->count == 0
+        || (window->count > 0 && w->max_time < window->max_time)) {
+      window = w;     /* Candidate to be replaced: free, or with the shortest windows. */
+    }
+  }
+
+  if (window->count == 0 || window->disable_caller != irqoff_caller
+      || window->enable_caller != caller) {
+    if (window->count > 0 && window->max_time >= time) {
+      return;         /* Shorter than all the ones kept. */
+    }
+    window->disable_caller = irqoff_caller;
+    window->enable_caller = caller;
+    window->count = 0;
+    window->max_time = 0;
+    window->total_time = 0;
+  }
+
+  window->count++;
+  window->total_time += time;
+  if (time > window->max_time) {
+    window->max_time = time;
+  }
+}
+#endif
+
 /* Dummy interrupt handler. */
-static void dummy_handler(struct interrupts_stack_frame *stack_frame) {
+static void dummy_handler(struct interrupts_stack_frame *stack_frame UNUSED, void *dev UNUSED) {
   printf("\nDummy Interrupt handler......");
 }
 
@@ -295,21 +1010,15 @@ static bool interrupts_is_valid_irq_number(unsigned char irq_number) {
   return true;
 }
 
-/* Enables the given IRQ in the interrupt controller (BCM2835 SoC - System on Chip). */
-static void interrupts_enable_irq(unsigned char irq_number) {
-  if (!interrupts_is_valid_irq_number(irq_number)) {
-        return;
-  }
+/* Writes the enable and disable registers of the interrupt controller, so only the enabled IRQs
+   of irq_unmasked and irq_allowed are enabled. */
+static void interrupts_write_unmasked(void) {
+  int32_t reg;
 
-  int32_t half_interrupts = IRQ_COUNT / 2;
-  int32_t *interrupt_ptr;
-  if (irq_number < half_interrupts) {
-      interrupt_ptr = (int32_t *) (INTERRUPT_REGISTER_ENABLE_IRQ_0_31);
-      *interrupt_ptr = *interrupt_ptr | (1 << irq_number);
-  } else {
-      irq_number = irq_number - half_interrupts;
-      interrupt_ptr = (int32_t *) (INTERRUPT_REGISTER_ENABLE_IRQ_32_63);
-      *interrupt_ptr = *interrupt_ptr | (1 << irq_number);
+  for (reg = 0; reg < IRQ_REGISTERS; reg++) {
+    uint32_t unmasked = irq_unmasked[reg] & irq_allowed[reg];
+    mmio_write(irq_disable_registers[reg], irq_enabled[reg] & ~unmasked);
+    mmio_write(irq_enable_registers[reg], irq_enabled[reg] & unmasked);
   }
 }
 
@@ -10,6 +10,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "flags.h"
+
 /* Enum that defines the status of the interrupts: ON or OFF. */
 enum interrupts_level {
   INTERRUPTS_OFF,       /* Interrupts disabled (IRQ and FIQ). */
@@ -40,27 +42,57 @@ struct interrupts_stack_frame {
   uint32_t r12;              /* Save r12 */
 };
 
-/* Signature of the interrupt handler function.*/
-typedef void interrupts_handler_function(struct interrupts_stack_frame *);
+/* Signature of the interrupt handler function. The stack frame is the one of the interrupted
+   thread, also for the handlers of nested IRQs. DEV is the pointer given when the handler was
+   registered, so a driver can serve several devices with the same handler.*/
+typedef void interrupts_handler_function(struct interrupts_stack_frame *, void *dev);
+
+/* Signature of the bottom half of a threaded IRQ, which runs in its own kernel thread. */
+typedef void interrupts_thread_function(void *aux);
+
+/* Number of IRQ priority levels. The IRQs have the lowest one (0) by default. */
+#define IRQ_PRIORITY_LEVELS 4
 
 /* Initializes the interrupt system.*/
 void interrupts_init(void);
 
 /* Register the IRQ handler for the given interrupt number. The BCM2835 has 64 IRQ interruptions
- * that are enumerated from 0 to 63.
+ * shared with the GPU, enumerated from 0 to 63, and 8 ARM specific ones, enumerated from 64 to 71
+ * (see bcm2835.h).
  */
 void interrupts_register_irq(unsigned char interrupt_number, interrupts_handler_function *,
-    const char *name);
-
-/* Register the SWI hander for the Software interrupts. */
-void interrupts_register_swi(interrupts_handler_function *, const char *name);
+    void *dev, const char *name);
+
+/* Adds a handler to an IRQ line shared by several devices. The handlers of the line are called in
+ * the order they were registered, and each one has to check whether its device raised the IRQ.
+ * Returns false if the IRQ number is not valid or there is no memory. */
+bool interrupts_register_shared_irq(unsigned char interrupt_number, interrupts_handler_function *,
+    void *dev, const char *name);
+
+/* Registers a threaded IRQ: TOP_HALF (can be NULL) runs in the IRQ context, with AUX as its DEV,
+ * and only has to acknowledge the interrupt in the device, and BOTTOM_HALF(AUX) runs in a kernel
+ * thread with the given thread PRIORITY, with the IRQ masked until it returns. Returns false if
+ * the thread can't be created. The scheduler doesn't implement priorities yet, so PRIORITY is
+ * only stored. */
+bool interrupts_register_threaded_irq(unsigned char interrupt_number,
+    interrupts_handler_function *top_half, interrupts_thread_function *bottom_half, void *aux,
+    const char *name, int32_t priority);
+
+/* Enables and disables the IRQ in the interrupt controller. */
+void interrupts_enable_irq(unsigned char interrupt_number);
+void interrupts_disable_irq(unsigned char interrupt_number);
+
+/* Masks all the IRQs but the given one, without disabling them, until interrupts_unmask_all(). */
+void interrupts_mask_all_except(unsigned char interrupt_number);
+void interrupts_unmask_all(void);
+
+/* Sets the priority (0 to IRQ_PRIORITY_LEVELS - 1) of the IRQ. The handler of an IRQ runs with the
+ * IRQs of higher priority enabled, so they nest over it. */
+void interrupts_set_irq_priority(unsigned char interrupt_number, uint8_t priority);
 
 /* Return the IRQ name that correspond to the interrupt number. */
 const char* interrupts_get_irq_name(unsigned char interrupt_number);
 
-/* Return the SWI name. */
-const char* interrupts_get_swi_name();
-
 /* Returns the interrupt level. */
 enum interrupts_level interrupts_get_level(void);
 
@@ -73,9 +105,48 @@ enum interrupts_level interrupts_enable(void);
 /* Disables the interrupts and returns the previous one. */
 enum interrupts_level interrupts_disable(void);
 
+/* Inline versions of interrupts_disable() and interrupts_set_level() for the hot paths, such as
+   the semaphores and the console: a CPSR read and a CPSID, instead of two calls to the functions
+   of interruptsHandlers.s. They only change the IRQ flag, like the functions. */
+
+/* Disables the IRQs and returns the previous interrupts level. */
+static inline enum interrupts_level interrupts_save(void) {
+#ifdef IRQOFF_TRACE
+  return interrupts_disable();      /* Traced, with the address of the caller. */
+#else
+  uint32_t cpsr;
+
+  asm volatile ("mrs %0, cpsr\n\tcpsid i" : "=r" (cpsr) : : "memory");
+  return cpsr & FLAG_IRQ ? INTERRUPTS_OFF : INTERRUPTS_ON;
+#endif
+}
+
+/* Sets the interrupts level returned by interrupts_save(). */
+static inline void interrupts_restore(enum interrupts_level level) {
+#ifdef IRQOFF_TRACE
+  interrupts_set_level(level);      /* Traced, with the address of the caller. */
+#else
+  if (level == INTERRUPTS_ON) {
+    asm volatile ("cpsie i" : : : "memory");
+  } else {
+    asm volatile ("cpsid i" : : : "memory");
+  }
+#endif
+}
+
 /* Prints status of the interrupts. */
 void interrupts_print_status(void);
 
+/* Prints the per IRQ statistics: calls, handler time and entry latency histogram (IRQ_STATS). */
+void interrupts_print_stats(void);
+
+/* Clears the per IRQ statistics. */
+void interrupts_reset_stats(void);
+
+/* Prints and clears the longest windows with the IRQs disabled (IRQOFF_TRACE). */
+void interrupts_print_irqoff(void);
+void interrupts_reset_irqoff(void);
+
 /* Returns true during processing of an external interrupt and false at all other times. */
 bool interrupts_context(void);
 /* Returns true if an IRQ was generated. Otherwise is false. */
@@ -87,12 +158,20 @@ bool interrupts_was_irq_generated(void);
    time. */
 void interrupts_yield_on_return (void);
 
-/* SWI: Software Interrupt Handler. */
-void interrupts_dispatch_swi(struct interrupts_stack_frame *stack_frame, int32_t swi_number);
-
 /* IRQ: Interrupt Request Handler. */
 void interrupts_dispatch_irq(struct interrupts_stack_frame *stack_frame) ;
 
+/* Data abort handler. FAULT_ADDRESS and FAULT_STATUS are the values of the FAR and DFSR.
+   Returns true if the fault has to be resolved by interrupts_resolve_data_abort(). */
+bool interrupts_dispatch_data_abort(struct interrupts_stack_frame *stack_frame,
+    void *fault_address, uint32_t fault_status);
+
+/* Resolves a demand paging fault in the thread that caused it. */
+void interrupts_resolve_data_abort(void *fault_address);
+
+/* Undefined instruction handler, for the instructions that are not VFP traps. */
+void interrupts_dispatch_undefined(struct interrupts_stack_frame *stack_frame);
+
 void interrupts_debug(struct interrupts_stack_frame *stack_frame);
 
 #endif /* THREADS_INTERRUPTS_H_ */
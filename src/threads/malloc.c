@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "../devices/timer.h"
 #include "palloc.h"
 #include "synch.h"
 #include "vaddr.h"
@@ -34,7 +35,19 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   When the kernel is built with the debug allocator
+   (ALLOCATOR_DEBUG, see the Makefile), every block also carries
+   a header in front of the caller's bytes and a redzone after
+   them.  free() uses them to detect double frees and overflows,
+   and poisons freed blocks to help detect use-after-free bugs.
+   The release allocator compiles all of that out, together with
+   the ALLOC_ASSERT() consistency checks.
+
+   Each descriptor counts its live blocks and arenas, and the
+   time every malloc() call takes is recorded in a histogram.
+   See memory_print_stats() and memory_get_snapshot(). */
 
 /* Descriptor. */
 struct desc
@@ -43,6 +56,11 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics, protected by LOCK. */
+    size_t live_cnt;            /* Blocks in use. */
+    size_t peak_live_cnt;       /* Highest value of live_cnt. */
+    size_t arena_cnt;           /* Arenas owned by the descriptor. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -62,10 +80,49 @@ struct block
     struct list_elem free_elem; /* Free list element. */
   };
 
+#ifdef ALLOCATOR_DEBUG
+/* Header that the debug allocator puts in front of every block. */
+struct block_header 
+  {
+    unsigned magic;             /* BLOCK_MAGIC while the block is in use. */
+    size_t size;                /* Bytes requested by the caller. */
+  };
+
+/* Magic number for detecting double frees and invalid blocks. */
+#define BLOCK_MAGIC 0x5eb1c0de
+
+/* Redzone that follows the caller's bytes to detect overflows. */
+#define REDZONE_SIZE 8
+#define REDZONE_BYTE 0xfd
+
+/* Bytes that the debug allocator adds to every request. */
+#define BLOCK_OVERHEAD (sizeof (struct block_header) + REDZONE_SIZE)
+#else
+#define BLOCK_OVERHEAD 0
+#endif
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_DESC_MAX];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Big block statistics. */
+static struct lock big_lock;    /* Protects the big block statistics. */
+static size_t big_cnt;          /* Big blocks in use. */
+static size_t big_page_cnt;     /* Pages used by big blocks. */
+
+/* Histogram of malloc() latencies.  Bucket I counts the calls
+   that took less than 2**I microseconds (and at least 2**(I-1)),
+   the last bucket counts everything slower.  Updated without
+   locking, so a count can occasionally be lost to preemption. */
+static uint32_t latency_histogram[MALLOC_LATENCY_BUCKETS];
+
+static void *malloc_block (size_t size);
+static void *block_prepare (void *block, size_t size);
+static void *block_validate (void *p);
+static size_t block_usable_size (void *p);
+static void count_big_pages (int page_cnt, int block_cnt);
+static void record_latency (int usecs);
+static struct desc *size_to_desc (size_t size);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -74,6 +131,9 @@ void malloc_init (void)  {
   printf("\nInitializing malloc.....");
 
   desc_cnt = 0;
+  big_cnt = 0;
+  big_page_cnt = 0;
+  lock_init (&big_lock);
   size_t block_size;
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
@@ -83,6 +143,9 @@ void malloc_init (void)  {
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      d->live_cnt = 0;
+      d->peak_live_cnt = 0;
+      d->arena_cnt = 0;
     }
 }
 
@@ -91,20 +154,33 @@ void malloc_init (void)  {
 void *
 malloc (size_t size) 
 {
-  struct desc *d;
-  struct block *b;
-  struct arena *a;
+  int start = timer_get_timestamp ();
+  void *p;
 
   /* A null pointer satisfies a request for 0 bytes. */
-  if (size == 0)
+  if (size == 0 || size > SIZE_MAX - BLOCK_OVERHEAD)
     return NULL;
 
+  p = malloc_block (size + BLOCK_OVERHEAD);
+  if (p != NULL)
+    p = block_prepare (p, size);
+
+  record_latency (timer_get_timestamp () - start);
+  return p;
+}
+
+/* Does the work of malloc().  SIZE includes BLOCK_OVERHEAD. */
+static void *
+malloc_block (size_t size) 
+{
+  struct desc *d;
+  struct block *b;
+  struct arena *a;
+
   /* Find the smallest descriptor that satisfies a SIZE-byte
      request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
+  d = size_to_desc (size);
+  if (d == NULL) 
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
@@ -118,6 +194,7 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      count_big_pages (page_cnt, 1);
       return a + 1;
     }
 
@@ -145,12 +222,15 @@ malloc (size_t size)
           struct block *b = arena_to_block (a, i);
           list_push_back (&d->free_list, &b->free_elem);
         }
+      d->arena_cnt++;
     }
 
   /* Get a block from free list and return it. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
   a->free_cnt--;
+  if (++d->live_cnt > d->peak_live_cnt)
+    d->peak_live_cnt = d->live_cnt;
   lock_release (&d->lock);
   return b;
 }
@@ -176,15 +256,90 @@ calloc (size_t a, size_t b)
   return p;
 }
 
-/* Returns the number of bytes allocated for BLOCK. */
+/* Prepares BLOCK, as returned by malloc_block(), to hand out
+   SIZE bytes and returns the pointer that the caller receives.
+   The debug allocator fills in the block header and the
+   redzone. */
+static void *
+block_prepare (void *block, size_t size) 
+{
+#ifdef ALLOCATOR_DEBUG
+  struct block_header *h = block;
+
+  h->magic = BLOCK_MAGIC;
+  h->size = size;
+  memset ((uint8_t *) (h + 1) + size, REDZONE_BYTE, REDZONE_SIZE);
+  return h + 1;
+#else
+  return block;
+#endif
+}
+
+/* Returns the block behind P, a pointer returned by malloc().
+   The debug allocator panics if P is not a block in use, which
+   catches double frees, or if its redzone was overwritten. */
+static void *
+block_validate (void *p) 
+{
+#ifdef ALLOCATOR_DEBUG
+  struct block_header *h = (struct block_header *) p - 1;
+  const uint8_t *redzone;
+  size_t i;
+
+  if (h->magic != BLOCK_MAGIC)
+    PANIC ("free(): double free or invalid block");
+
+  redzone = (const uint8_t *) p + h->size;
+  for (i = 0; i < REDZONE_SIZE; i++)
+    if (redzone[i] != REDZONE_BYTE)
+      PANIC ("free(): block overflowed into its redzone");
+  return h;
+#else
+  return p;
+#endif
+}
+
+/* Returns the number of bytes the caller may use at P, a
+   pointer returned by malloc(). */
 static size_t
-block_size (void *block) 
+block_usable_size (void *p) 
 {
-  struct block *b = block;
-  struct arena *a = block_to_arena (b);
+#ifdef ALLOCATOR_DEBUG
+  return ((struct block_header *) block_validate (p))->size;
+#else
+  struct arena *a = block_to_arena (p);
   struct desc *d = a->desc;
 
-  return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+  return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (p);
+#endif
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes in place.
+   Returns true if OLD_BLOCK now holds at least NEW_SIZE bytes,
+   false if it has to be moved.
+
+   A normal block stays put as long as NEW_SIZE maps to the same
+   descriptor.  A big block gives back the pages it no longer
+   needs, or grows into the free pages that follow it. */
+static bool
+resize_in_place (void *old_block, size_t new_size) 
+{
+  struct arena *a = block_to_arena (old_block);
+  struct desc *d = a->desc;
+
+  if (d != NULL)
+    return d == size_to_desc (new_size);
+  else if (size_to_desc (new_size) != NULL)
+    return false;
+  else
+    {
+      size_t page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+      if (!palloc_resize_multiple (a, a->free_cnt, page_cnt))
+        return false;
+      count_big_pages ((int) page_cnt - (int) a->free_cnt, 0);
+      a->free_cnt = page_cnt;
+      return true;
+    }
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -201,12 +356,16 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block != NULL && new_size <= SIZE_MAX - BLOCK_OVERHEAD
+           && resize_in_place (block_validate (old_block),
+                               new_size + BLOCK_OVERHEAD))
+    return block_prepare (block_validate (old_block), new_size);
   else 
     {
       void *new_block = malloc (new_size);
       if (old_block != NULL && new_block != NULL)
         {
-          size_t old_size = block_size (old_block);
+          size_t old_size = block_usable_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
           free (old_block);
@@ -222,7 +381,7 @@ free (void *p)
 {
   if (p != NULL)
     {
-      struct block *b = p;
+      struct block *b = block_validate (p);
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
       
@@ -230,7 +389,7 @@ free (void *p)
         {
           /* It's a normal block.  We handle it here. */
 
-#ifndef NDEBUG
+#ifdef ALLOCATOR_DEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
@@ -239,19 +398,21 @@ free (void *p)
 
           /* Add block to free list. */
           list_push_front (&d->free_list, &b->free_elem);
+          d->live_cnt--;
 
           /* If the arena is now entirely unused, free it. */
           if (++a->free_cnt >= d->blocks_per_arena) 
             {
               size_t i;
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
+              ALLOC_ASSERT (a->free_cnt == d->blocks_per_arena);
               for (i = 0; i < d->blocks_per_arena; i++) 
                 {
                   struct block *b = arena_to_block (a, i);
                   list_remove (&b->free_elem);
                 }
               palloc_free_page (a);
+              d->arena_cnt--;
             }
 
           lock_release (&d->lock);
@@ -259,12 +420,110 @@ free (void *p)
       else
         {
           /* It's a big block.  Free its pages. */
+          count_big_pages (-(int) a->free_cnt, -1);
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Fills SNAPSHOT with the current page allocator and malloc()
+   statistics. */
+void
+memory_get_snapshot (struct memory_snapshot *snapshot) 
+{
+  size_t i;
+
+  memset (snapshot, 0, sizeof *snapshot);
+  palloc_get_stats (0, &snapshot->kernel_pool);
+  palloc_get_stats (PAL_USER, &snapshot->user_pool);
+
+  snapshot->desc_cnt = desc_cnt;
+  for (i = 0; i < desc_cnt; i++) 
+    {
+      struct desc *d = &descs[i];
+      struct malloc_desc_stats *stats = &snapshot->descs[i];
+
+      lock_acquire (&d->lock);
+      stats->block_size = d->block_size;
+      stats->live_cnt = d->live_cnt;
+      stats->peak_live_cnt = d->peak_live_cnt;
+      stats->arena_cnt = d->arena_cnt;
+      lock_release (&d->lock);
+    }
+
+  lock_acquire (&big_lock);
+  snapshot->big_cnt = big_cnt;
+  snapshot->big_page_cnt = big_page_cnt;
+  lock_release (&big_lock);
+
+  for (i = 0; i < MALLOC_LATENCY_BUCKETS; i++)
+    snapshot->latency_histogram[i] = latency_histogram[i];
+}
+
+/* Prints page allocator and malloc() statistics. */
+void
+memory_print_stats (void) 
+{
+  static struct memory_snapshot snapshot;
+  size_t i;
+
+  memory_get_snapshot (&snapshot);
+
+  palloc_print_stats ();
+  for (i = 0; i < snapshot.desc_cnt; i++) 
+    {
+      struct malloc_desc_stats *stats = &snapshot.descs[i];
+      printf ("\nMalloc %4u bytes: %u blocks (peak %u), %u arenas",
+              stats->block_size, stats->live_cnt, stats->peak_live_cnt,
+              stats->arena_cnt);
+    }
+  printf ("\nMalloc big blocks: %u blocks, %u pages",
+          snapshot.big_cnt, snapshot.big_page_cnt);
+
+  printf ("\nMalloc latency (us):");
+  for (i = 0; i < MALLOC_LATENCY_BUCKETS - 1; i++)
+    printf (" <%u: %u", 1u << i, snapshot.latency_histogram[i]);
+  printf (" >=%u: %u", 1u << (MALLOC_LATENCY_BUCKETS - 2),
+          snapshot.latency_histogram[MALLOC_LATENCY_BUCKETS - 1]);
+}
+
+/* Adds PAGE_CNT pages and BLOCK_CNT blocks, either of which may
+   be negative, to the big block statistics. */
+static void
+count_big_pages (int page_cnt, int block_cnt) 
+{
+  lock_acquire (&big_lock);
+  big_page_cnt += page_cnt;
+  big_cnt += block_cnt;
+  lock_release (&big_lock);
+}
+
+/* Adds a malloc() call that took USECS microseconds to the
+   latency histogram. */
+static void
+record_latency (int usecs) 
+{
+  size_t bucket = 0;
+
+  while (bucket < MALLOC_LATENCY_BUCKETS - 1 && usecs >= (1 << bucket))
+    bucket++;
+  latency_histogram[bucket]++;
+}
+
+/* Returns the smallest descriptor whose blocks can hold SIZE
+   bytes, or a null pointer if SIZE needs a big block. */
+static struct desc *
+size_to_desc (size_t size) 
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      return d;
+  return NULL;
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -272,13 +531,13 @@ block_to_arena (struct block *b)
   struct arena *a = pg_round_down (b);
 
   /* Check that the arena is valid. */
-  ASSERT (a != NULL);
-  ASSERT (a->magic == ARENA_MAGIC);
+  ALLOC_ASSERT (a != NULL);
+  ALLOC_ASSERT (a->magic == ARENA_MAGIC);
 
   /* Check that the block is properly aligned for the arena. */
-  ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+  ALLOC_ASSERT (a->desc == NULL
+                || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
+  ALLOC_ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
 
   return a;
 }
@@ -287,10 +546,48 @@ block_to_arena (struct block *b)
 static struct block *
 arena_to_block (struct arena *a, size_t idx) 
 {
-  ASSERT (a != NULL);
-  ASSERT (a->magic == ARENA_MAGIC);
-  ASSERT (idx < a->desc->blocks_per_arena);
+  ALLOC_ASSERT (a != NULL);
+  ALLOC_ASSERT (a->magic == ARENA_MAGIC);
+  ALLOC_ASSERT (idx < a->desc->blocks_per_arena);
   return (struct block *) ((uint8_t *) a
                            + sizeof *a
                            + idx * a->desc->block_size);
 }
+
+/* Number of blocks and block size used by malloc_benchmark(). */
+#define BENCHMARK_BLOCKS 256
+#define BENCHMARK_BLOCK_SIZE 64
+#define BENCHMARK_ROUNDS 16
+
+/* Measures the cost of the free() path.  Run it once in a
+   kernel built with ALLOCATOR=debug and once with
+   ALLOCATOR=release to compare both allocator modes.  Prints the
+   elapsed system timer ticks (microseconds). */
+void
+malloc_benchmark (void) 
+{
+  static void *blocks[BENCHMARK_BLOCKS];
+  int free_time = 0;
+  int round, i;
+
+  for (round = 0; round < BENCHMARK_ROUNDS; round++) 
+    {
+      int start;
+
+      for (i = 0; i < BENCHMARK_BLOCKS; i++)
+        blocks[i] = malloc (BENCHMARK_BLOCK_SIZE);
+
+      start = timer_get_timestamp ();
+      for (i = 0; i < BENCHMARK_BLOCKS; i++)
+        free (blocks[i]);
+      free_time += timer_get_timestamp () - start;
+    }
+
+#ifdef ALLOCATOR_DEBUG
+  printf ("\nMalloc benchmark (debug allocator):");
+#else
+  printf ("\nMalloc benchmark (release allocator):");
+#endif
+  printf ("\n  free() of %d x %d blocks of %d bytes: %d us",
+          BENCHMARK_ROUNDS, BENCHMARK_BLOCKS, BENCHMARK_BLOCK_SIZE, free_time);
+}
@@ -3,6 +3,37 @@
 
 #include <debug.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "palloc.h"
+
+/* Maximum number of malloc() size classes (descriptors). */
+#define MALLOC_DESC_MAX 10
+
+/* Number of buckets in the malloc() latency histogram. */
+#define MALLOC_LATENCY_BUCKETS 8
+
+/* Statistics of one malloc() size class. */
+struct malloc_desc_stats
+  {
+    uint32_t block_size;        /* Size of each block in bytes. */
+    uint32_t live_cnt;          /* Blocks in use. */
+    uint32_t peak_live_cnt;     /* Highest number of blocks in use. */
+    uint32_t arena_cnt;         /* Arenas (pages) owned by the class. */
+  };
+
+/* Compact binary snapshot of the memory allocator statistics.
+   Every field is 32 bits wide, so the layout has no padding. */
+struct memory_snapshot
+  {
+    struct palloc_stats kernel_pool;
+    struct palloc_stats user_pool;
+    uint32_t desc_cnt;          /* Number of entries used in DESCS. */
+    struct malloc_desc_stats descs[MALLOC_DESC_MAX];
+    uint32_t big_cnt;           /* Big blocks in use. */
+    uint32_t big_page_cnt;      /* Pages used by big blocks. */
+    uint32_t latency_histogram[MALLOC_LATENCY_BUCKETS];
+  };
 
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
@@ -10,4 +41,8 @@ void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
 
+void memory_get_snapshot (struct memory_snapshot *);
+void memory_print_stats (void);
+void malloc_benchmark (void);
+
 #endif /* threads/malloc.h */
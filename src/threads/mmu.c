@@ -0,0 +1,1027 @@
+/*
+ * mmu.c
+ *
+ * Builds the first level translation table of the ARM1176JZF-S and enables the MMU.
+ *
+ * The table has 4096 entries and each one identity maps a 1 MB section (virtual address ==
+ * physical address), so turning the MMU on doesn't move anything. What the table adds is the
+ * memory type of every section:
+ *
+ *      0x00000000 - 0x1FFFFFFF     RAM             Normal, cacheable write-back
+ *      0x20000000 - 0x20FFFFFF     Peripherals     Device
+ *      0x21000000 - 0xFFFFFFFF     Bus aliases     Strongly ordered
+ *
+ * The entries use the ARMv6 format (XP bit set in the Control Register).
+ *
+ * A section that needs a mapping finer than 1 MB (for example, an unmapped guard page below a
+ * thread stack) is split into a second level (coarse) table of 256 entries, each one mapping a
+ * 4 KB small page with the same attributes that the section had. The coarse tables are 1 KB, so
+ * they are carved four at a time from pages of the page allocator into a free list. The tables of
+ * the kernel are never released; the ones of the user address spaces go back to the free list.
+ *
+ * The tables are modified with the interrupts off, where palloc_get_page() can't be called: it
+ * takes the pool lock and can sleep. mmu_page_table_reserve() allocates the page for the tables
+ * before the interrupts are disabled, so the table updates don't need to allocate memory.
+ *
+ * User address spaces: TTBCR.N = 2, so TTBR0 translates [0, 1 GB) with a table of 1024 entries
+ * (4 KB) and TTBR1 translates the rest with the kernel table. Every user process has its own
+ * TTBR0 table:
+ *
+ *      0x00000000 - 0x2FFFFFFF     Copy of the kernel entries (global, privileged access only)
+ *      0x30000000 - 0x3FFFFFFF     User pages (not global, tagged with the ASID of the process)
+ *
+ * The kernel threads use the first 1024 entries of the kernel table as their TTBR0 table and the
+ * ASID 0. Every process gets a non-zero ASID (Address Space ID), so switching between processes
+ * only writes TTBR0 and the Context ID; the TLB keeps the entries of all of them. When the 255
+ * ASIDs are used up, a new generation starts: the whole TLB is invalidated and the processes get
+ * new ASIDs the next time they run.
+ *
+ * Scope: the threads that own an address space still run in SYS mode (see create_thread() in
+ * thread.c), so the AP bits don't protect the kernel from them yet. Running them in USER mode needs
+ * a kernel stack per thread: the IRQ, SWI and abort handlers save the state on the SYS stack, which
+ * USER mode shares, and thread_current() is found from that stack pointer.
+ *
+ * Copy-on-write: mmu_address_space_clone() copies only the tables of a process. The writable pages
+ * become read-only in both address spaces and their frames get one more reference in the frame
+ * table (frame.c). The first write to one of them causes a permission fault, resolved by
+ * mmu_copy_on_write(): the writer gets its own copy, or the page back if it is the last owner.
+ * The pages of the shared memory regions (shm.c) stay writable and shared in both. Read-only
+ * pages use AP = 0b10 and copy-on-write pages AP = 0b11, both with APX set, so they are read-only
+ * in SYS mode too and the fault handler can tell them apart.
+ *
+ * Note: mmu_init() runs before main(), when the console doesn't exist yet, so it can't print or
+ * use ASSERT().
+ */
+
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../devices/bcm2835.h"
+#include "../devices/timer.h"
+#include "frame.h"
+#include "interrupt.h"
+#include "malloc.h"
+#include "mmu.h"
+#include "palloc.h"
+#include "thread.h"
+#include "vaddr.h"
+
+/* Number of entries of the first level translation table (4 GB / 1 MB). */
+#define MMU_TABLE_ENTRIES 4096
+
+/* Bits of a section entry (ARMv6 format). */
+#define SECTION_TYPE    0x2             /* Bits [1:0] = 0b10: Section. */
+#define SECTION_B       (1 << 2)        /* Bufferable. */
+#define SECTION_C       (1 << 3)        /* Cacheable. */
+#define SECTION_XN      (1 << 4)        /* Execute never. */
+#define SECTION_AP_KERNEL (1 << 10)     /* AP = 0b01, APX = 0: Read/write in privileged modes. */
+#define SECTION_TEX(X)  ((X) << 12)     /* Type extension. */
+#define SECTION_MASK    0x3             /* Bits [1:0]: Type of the entry. */
+
+/* Number of entries of a second level (coarse) table (1 MB / 4 KB). */
+#define PAGE_TABLE_ENTRIES 256
+#define PAGE_TABLE_SIZE (PAGE_TABLE_ENTRIES * sizeof (uint32_t))
+
+/* Bits of a first level entry that points to a coarse table, and of a small page entry. */
+#define COARSE_TYPE     0x1             /* Bits [1:0] = 0b01: Coarse page table. */
+#define PAGE_TYPE       0x2             /* Bits [1:0] = 0b1x: Small page. */
+#define PAGE_XN         0x1             /* Execute never. */
+#define PAGE_B          (1 << 2)        /* Bufferable. */
+#define PAGE_C          (1 << 3)        /* Cacheable. */
+#define PAGE_APX        (1 << 9)        /* Access permission extension. */
+#define PAGE_AP_USER_RW (3 << 4)        /* AP = 0b11, APX = 0: Read/write in every mode. */
+#define PAGE_AP_USER_RO (PAGE_APX | (2 << 4))   /* AP = 0b10, APX = 1: Read only in every mode. */
+#define PAGE_AP_COW     (PAGE_APX | (3 << 4))   /* AP = 0b11, APX = 1: The same, copy-on-write. */
+#define PAGE_AP_MASK    (PAGE_APX | (3 << 4))
+#define PAGE_TEX(X)     ((X) << 6)      /* Type extension. */
+#define PAGE_NG         (1 << 11)       /* Not global: the TLB entry is tagged with the ASID. */
+#define PAGE_ADDRESS(E) ((E) & ~(PGSIZE - 1))
+
+/* Bits of the fault entries (bits [1:0] = 0b00) of the user pages reserved for demand paging.
+   The MMU ignores the rest of the bits of a fault entry. */
+#define LAZY_ZERO       (1 << 2)        /* Gets a zeroed page on the first access. */
+#define LAZY_WRITABLE   (1 << 3)        /* Writable in user mode once it is mapped. */
+
+/* Number of entries of the TTBR0 tables ([0, 1 GB) / 1 MB). */
+#define USER_TABLE_ENTRIES 1024
+#define USER_FIRST_SECTION (MMU_USER_BASE / MMU_SECTION_SIZE)
+
+/* Highest ASID. The ASID 0 is reserved for the kernel. */
+#define MMU_ASID_MAX 255
+
+/* Address space of a user process. */
+struct address_space {
+  uint32_t *table;              /* First level table of [0, 1 GB), used as TTBR0 (4 KB). */
+  uint32_t asid;                /* Address Space ID that tags its TLB entries. */
+  uint32_t asid_generation;     /* ASID generation in which ASID was assigned. */
+  struct list_elem elem;        /* Element of the address_spaces list. */
+};
+
+/* Functions defined in mmu.s. */
+extern void mmu_enable(uint32_t *translation_table);
+extern void mmu_invalidate_tlb(void);
+extern void mmu_invalidate_tlb_entry(uint32_t mva_asid);
+extern void mmu_invalidate_tlb_asid(uint32_t asid);
+extern void mmu_switch_address_space(uint32_t *table, uint32_t asid);
+extern void cache_clean_line(void *address);
+extern void cache_clean_invalidate_all(void);
+
+/* Function defined in memoryCopy.s. */
+extern void memory_fastest_copy(char *src, char *dest, int size);
+
+/* First level translation table. It has to be aligned to 16 KB. */
+static uint32_t translation_table[MMU_TABLE_ENTRIES] __attribute__ ((aligned (16384)));
+
+/* Free coarse tables, linked through their first entry. */
+static uint32_t *free_page_tables;
+
+/* All the user address spaces. Their kernel entries are updated with the kernel table. */
+static struct list address_spaces;
+
+/* Active user address space, or NULL if the kernel table is used. */
+static struct address_space *current_address_space;
+
+/* Current ASID generation and next ASID to assign in it. */
+static uint32_t asid_generation;
+static uint32_t next_asid;
+
+/* Returns the attribute bits of a section entry for the memory type TYPE. */
+static uint32_t mmu_section_attributes(enum mmu_memory_type type);
+
+/* Returns the second level table of the section that contains ADDRESS, splitting the section
+   if necessary. */
+static uint32_t *mmu_get_page_table(uintptr_t address);
+
+/* Returns the attribute bits of a small page entry that maps memory like the SECTION_ENTRY. */
+static uint32_t mmu_page_attributes(uint32_t section_entry);
+
+/* Sets the entry SECTION of the kernel table and of the user tables that copy it. */
+static void mmu_set_section_entry(uint32_t section, uint32_t entry);
+
+/* Disables the interrupts once there is a free coarse table, and allocates and releases them. */
+static bool mmu_page_table_reserve(enum interrupts_level *old_level);
+static uint32_t *mmu_page_table_alloc(void);
+static void mmu_page_table_free(uint32_t *page_table);
+
+/* Returns the entry of the user page that contains UADDR, or NULL if its section has no table. */
+static uint32_t *mmu_lookup_user_page(struct address_space *as, const void *uaddr);
+
+/* Returns the entry of the user page UPAGE of AS, creating the coarse table if necessary. */
+static uint32_t *mmu_create_user_page(struct address_space *as, const void *upage);
+
+/* Returns the small page entry that maps a user page to KPAGE. */
+static uint32_t mmu_user_page_entry(void *kpage, bool writable);
+
+/* Returns true if ENTRY maps a page shared by copy-on-write. */
+static bool mmu_is_copy_on_write_entry(uint32_t entry);
+
+/* Makes AS the address space of the thread CUR and activates it. */
+static void mmu_benchmark_switch(struct thread *cur, struct address_space *as);
+
+/* Invalidates the TLB entry of the user page UPAGE of AS, if AS has a valid ASID. */
+static void mmu_invalidate_user_page(struct address_space *as, void *upage);
+
+/* Builds the identity translation table and enables the MMU, the caches and the branch
+   prediction. It is called by start.s before main(). */
+void mmu_init(void) {
+  uint32_t section;
+
+  free_page_tables = NULL;
+  list_init(&address_spaces);
+  current_address_space = NULL;
+  asid_generation = 1;
+  next_asid = 1;
+
+  for (section = 0; section < MMU_TABLE_ENTRIES; section++) {
+    uint32_t address = section * MMU_SECTION_SIZE;
+    enum mmu_memory_type type;
+
+    if (address < PERIPHERALS_BASE) {
+      type = MMU_MEMORY_NORMAL;
+    } else if (address < PERIPHERALS_BASE + 0x1000000) {
+      type = MMU_MEMORY_DEVICE;
+    } else {
+      type = MMU_MEMORY_STRONGLY_ORDERED;
+    }
+
+    translation_table[section] = address | mmu_section_attributes(type);
+  }
+
+  mmu_enable(translation_table);  // mmu_enable() is defined in mmu.s.
+}
+
+/* Sets the memory type of the sections that contain the SIZE bytes starting at START.
+ *
+ * The whole 1 MB sections change their type. The data cache is cleaned and invalidated first, so
+ * no dirty line of memory that becomes uncached is written back later over it. */
+void mmu_set_memory_type(void *start, size_t size, enum mmu_memory_type type) {
+  uint32_t first = (uintptr_t) start / MMU_SECTION_SIZE;
+  uint32_t last = ((uintptr_t) start + size - 1) / MMU_SECTION_SIZE;
+  uint32_t section;
+
+  if (size == 0) {
+    return;
+  }
+
+  enum interrupts_level old_level = interrupts_disable();
+  cache_clean_invalidate_all();
+  for (section = first; section <= last; section++) {
+    mmu_set_section_entry(section, (section * MMU_SECTION_SIZE) | mmu_section_attributes(type));
+  }
+  mmu_invalidate_tlb();
+  interrupts_set_level(old_level);
+}
+
+/* Unmaps the 4 KB page PAGE, so any access to it causes a data abort (translation fault). Returns
+   false if there wasn't memory for the second level table.
+
+   The page has to be in a section that only has normal memory, because the page allocator owns
+   it. Note that mmu_set_memory_type() replaces the second level table of a section. */
+bool mmu_unmap_page(void *page) {
+  uintptr_t address = (uintptr_t) page;
+  enum interrupts_level old_level;
+  ASSERT (pg_ofs(page) == 0);
+
+  if (!mmu_page_table_reserve(&old_level)) {
+    return false;
+  }
+  uint32_t *page_table = mmu_get_page_table(address);
+  uint32_t *entry = &page_table[(address % MMU_SECTION_SIZE) / PGSIZE];
+  *entry = 0;                     /* Fault entry. */
+  cache_clean_line(entry);
+  mmu_invalidate_tlb();
+  interrupts_set_level(old_level);
+
+  return true;
+}
+
+/* Maps again the 4 KB page PAGE that was unmapped by mmu_unmap_page(). It doesn't allocate
+   memory or take locks, so it can be called while a thread is being destroyed. */
+void mmu_remap_page(void *page) {
+  uintptr_t address = (uintptr_t) page;
+  uint32_t section = address / MMU_SECTION_SIZE;
+  ASSERT (pg_ofs(page) == 0);
+
+  enum interrupts_level old_level = interrupts_disable();
+  if ((translation_table[section] & SECTION_MASK) == COARSE_TYPE) {
+    uint32_t *page_table = (uint32_t *) (translation_table[section] & ~(PAGE_TABLE_SIZE - 1));
+    uint32_t *entry = &page_table[(address % MMU_SECTION_SIZE) / PGSIZE];
+    *entry = address | mmu_page_attributes(mmu_section_attributes(MMU_MEMORY_NORMAL));
+    cache_clean_line(entry);
+    mmu_invalidate_tlb();
+  }
+  interrupts_set_level(old_level);
+}
+
+/* Returns the second level table of the section that contains ADDRESS, splitting the section
+   if necessary. Interrupts must be off, after mmu_page_table_reserve().
+
+   The new table maps the 256 pages of the section exactly as the section did, so the split
+   doesn't change anything until one of its entries is modified. */
+static uint32_t *mmu_get_page_table(uintptr_t address) {
+  uint32_t section = address / MMU_SECTION_SIZE;
+  uint32_t section_entry = translation_table[section];
+  uint32_t *page_table;
+  uint32_t page;
+
+  if ((section_entry & SECTION_MASK) == COARSE_TYPE) {
+    return (uint32_t *) (section_entry & ~(PAGE_TABLE_SIZE - 1));
+  }
+
+  page_table = mmu_page_table_alloc();
+  for (page = 0; page < PAGE_TABLE_ENTRIES; page++) {
+    page_table[page] = (section * MMU_SECTION_SIZE + page * PGSIZE)
+        | mmu_page_attributes(section_entry);
+  }
+  cache_clean_range(page_table, PAGE_TABLE_SIZE);   // The table walks don't use the cache.
+
+  mmu_set_section_entry(section, (uint32_t) page_table | COARSE_TYPE);
+  mmu_invalidate_tlb();
+
+  return page_table;
+}
+
+/* Sets the entry SECTION of the kernel table and of the user tables that copy it, and cleans
+   them from the data cache. The caller invalidates the TLB. Interrupts must be off. */
+static void mmu_set_section_entry(uint32_t section, uint32_t entry) {
+  struct list_elem *e;
+
+  translation_table[section] = entry;
+  cache_clean_line(&translation_table[section]);
+
+  if (section >= USER_FIRST_SECTION) {
+    return;
+  }
+  for (e = list_begin(&address_spaces); e != list_end(&address_spaces); e = list_next(e)) {
+    struct address_space *as = list_entry(e, struct address_space, elem);
+    as->table[section] = entry;
+    cache_clean_line(&as->table[section]);
+  }
+}
+
+/* Disables the interrupts, and stores the previous level in OLD_LEVEL, once there is a free coarse
+   table, so the caller can take one with mmu_page_table_alloc() in the same interrupts off section.
+   If there is none, a page is allocated for four more before the interrupts are disabled. Returns
+   false, with the interrupts at the level of the caller, if there is no memory.
+
+   If another thread adds tables while the page is allocated, all of them are kept for later. */
+static bool mmu_page_table_reserve(enum interrupts_level *old_level) {
+  uint8_t *page;
+  size_t i;
+
+  *old_level = interrupts_disable();
+  if (free_page_tables != NULL) {
+    return true;
+  }
+  interrupts_set_level(*old_level);
+
+  page = palloc_get_page(0);
+  if (page == NULL) {
+    return false;
+  }
+
+  *old_level = interrupts_disable();
+  for (i = 0; i < PGSIZE / PAGE_TABLE_SIZE; i++) {
+    mmu_page_table_free((uint32_t *) (page + i * PAGE_TABLE_SIZE));
+  }
+  return true;
+}
+
+/* Returns a coarse table (1 KB aligned). The content of the table is undefined. Interrupts must
+   be off, after mmu_page_table_reserve(). */
+static uint32_t *mmu_page_table_alloc(void) {
+  uint32_t *page_table = free_page_tables;
+
+  ASSERT (page_table != NULL);
+  free_page_tables = (uint32_t *) page_table[0];
+  return page_table;
+}
+
+/* Releases the coarse table PAGE_TABLE. Interrupts must be off. */
+static void mmu_page_table_free(uint32_t *page_table) {
+  page_table[0] = (uint32_t) free_page_tables;
+  free_page_tables = page_table;
+}
+
+/* Creates a user address space with the kernel mappings and no user pages. Returns NULL if there
+   is no memory. It gets its ASID the first time it is activated. */
+struct address_space *mmu_address_space_create(void) {
+  struct address_space *as = malloc(sizeof *as);
+  uint32_t section;
+
+  if (as == NULL) {
+    return NULL;
+  }
+  as->table = palloc_get_page(0);
+  if (as->table == NULL) {
+    free(as);
+    return NULL;
+  }
+  as->asid = 0;
+  as->asid_generation = 0;      /* No ASID yet. */
+
+  enum interrupts_level old_level = interrupts_disable();
+  for (section = 0; section < USER_TABLE_ENTRIES; section++) {
+    as->table[section] = section < USER_FIRST_SECTION ? translation_table[section] : 0;
+  }
+  cache_clean_range(as->table, PGSIZE);   // The table walks don't use the cache.
+  list_push_back(&address_spaces, &as->elem);
+  interrupts_set_level(old_level);
+
+  return as;
+}
+
+/* Destroys the address space AS, releasing its tables and its references to the pages that are
+   mapped in it (the pages that are not shared with other address spaces are released). AS can't
+   be the active address space. It takes the malloc lock, so the scheduler can't call it: a dying
+   thread destroys its address space in thread_exit().
+
+   Its TLB entries are left: its ASID is not assigned again before the TLB is invalidated at the
+   start of the next ASID generation. */
+void mmu_address_space_destroy(struct address_space *as) {
+  uint32_t section;
+  uint32_t page;
+
+  ASSERT (as != NULL);
+  ASSERT (as != current_address_space);
+
+  enum interrupts_level old_level = interrupts_disable();
+  list_remove(&as->elem);
+  interrupts_set_level(old_level);
+
+  /* AS is not active and no other thread uses it, so its tables don't change: the frames are
+     released with the interrupts on, because the last reference frees the page. */
+  for (section = USER_FIRST_SECTION; section < USER_TABLE_ENTRIES; section++) {
+    if ((as->table[section] & SECTION_MASK) == COARSE_TYPE) {
+      uint32_t *page_table = (uint32_t *) (as->table[section] & ~(PAGE_TABLE_SIZE - 1));
+      for (page = 0; page < PAGE_TABLE_ENTRIES; page++) {
+        if (page_table[page] & PAGE_TYPE) {
+          frame_release((void *) PAGE_ADDRESS(page_table[page]));
+        }
+      }
+      old_level = interrupts_disable();
+      mmu_page_table_free(page_table);
+      interrupts_set_level(old_level);
+    }
+  }
+
+  palloc_free_page(as->table);
+  free(as);
+}
+
+/* Creates a copy of the user address space PARENT that shares its pages by copy-on-write. Only
+   the coarse tables are copied, so it doesn't depend on the number of mapped pages. The writable
+   pages become read-only in both address spaces until they are written, except the pages of the
+   shared memory regions (shm.c), which stay writable and shared. The pages reserved for
+   demand paging stay reserved in both. Returns NULL if there is no memory.
+
+   Every section is copied with the interrupts off, so no thread of PARENT writes to a page while
+   it is being shared. */
+struct address_space *mmu_address_space_clone(struct address_space *parent) {
+  struct address_space *child;
+  uint32_t section;
+  uint32_t page;
+  bool success = true;
+
+  ASSERT (parent != NULL);
+
+  child = mmu_address_space_create();
+  if (child == NULL) {
+    return NULL;
+  }
+
+  for (section = USER_FIRST_SECTION; success && section < USER_TABLE_ENTRIES; section++) {
+    enum interrupts_level old_level;
+    if (!mmu_page_table_reserve(&old_level)) {
+      success = false;
+      break;
+    }
+    if ((parent->table[section] & SECTION_MASK) == COARSE_TYPE) {
+      uint32_t *parent_table = (uint32_t *) (parent->table[section] & ~(PAGE_TABLE_SIZE - 1));
+      uint32_t *child_table = mmu_create_user_page(child, (void *) (section * MMU_SECTION_SIZE));
+
+      for (page = 0; page < PAGE_TABLE_ENTRIES; page++) {
+        uint32_t entry = parent_table[page];
+        if (entry & PAGE_TYPE) {
+          if ((entry & PAGE_AP_MASK) == PAGE_AP_USER_RW
+              && !frame_is_shared_memory((void *) PAGE_ADDRESS(entry))) {
+            entry = (entry & ~PAGE_AP_MASK) | PAGE_AP_COW;
+            parent_table[page] = entry;
+          }
+          frame_share((void *) PAGE_ADDRESS(entry));
+        }
+        child_table[page] = entry;
+      }
+      cache_clean_range(parent_table, PAGE_TABLE_SIZE);
+      cache_clean_range(child_table, PAGE_TABLE_SIZE);
+      if (parent->asid_generation == asid_generation) {
+        mmu_invalidate_tlb_asid(parent->asid);              // Defined in mmu.s.
+      }
+    }
+    interrupts_set_level(old_level);
+  }
+
+  if (!success) {
+    mmu_address_space_destroy(child);
+    return NULL;
+  }
+  return child;
+}
+
+/* Returns true if FAULT_ADDRESS is in a page of the active address space that is shared by
+   copy-on-write. It is called by the data abort handler, so it doesn't take locks or allocate
+   memory. */
+bool mmu_is_copy_on_write_fault(const void *fault_address) {
+  uint32_t *entry;
+
+  if (current_address_space == NULL) {
+    return false;
+  }
+  entry = mmu_lookup_user_page(current_address_space, fault_address);
+  return entry != NULL && mmu_is_copy_on_write_entry(*entry);
+}
+
+/* Makes writable the page shared by copy-on-write that contains FAULT_ADDRESS, in the active
+   address space. If other address spaces still map its frame, the page is copied to a new page
+   of the user pool; otherwise the frame is just made writable again. It runs in the thread that
+   caused the fault (see data_abort_resolve in interruptsHandlers.s). Returns false if there is no
+   memory.
+
+   The copy is done with the interrupts on. The frame can't change meanwhile, because every
+   address space maps it read-only while it is shared. */
+bool mmu_copy_on_write(const void *fault_address) {
+  void *upage = pg_round_down(fault_address);
+  void *new_kpage = NULL;
+
+  for (;;) {
+    enum interrupts_level old_level = interrupts_disable();
+    struct address_space *as = current_address_space;
+    uint32_t *entry = as != NULL ? mmu_lookup_user_page(as, upage) : NULL;
+    void *old_kpage;
+
+    if (entry == NULL || !mmu_is_copy_on_write_entry(*entry)) {
+      /* Another thread of the process resolved it first. */
+      interrupts_set_level(old_level);
+      break;
+    }
+
+    old_kpage = (void *) PAGE_ADDRESS(*entry);
+    if (!frame_is_shared(old_kpage)) {
+      *entry = (*entry & ~PAGE_AP_MASK) | PAGE_AP_USER_RW;
+      cache_clean_line(entry);
+      mmu_invalidate_user_page(as, upage);
+      interrupts_set_level(old_level);
+      break;
+    }
+
+    if (new_kpage != NULL) {
+      *entry = mmu_user_page_entry(new_kpage, true);
+      cache_clean_line(entry);
+      mmu_invalidate_user_page(as, upage);
+      interrupts_set_level(old_level);
+      frame_release(old_kpage);
+      return true;
+    }
+
+    interrupts_set_level(old_level);
+    new_kpage = palloc_get_page(PAL_USER);
+    if (new_kpage == NULL) {
+      return false;
+    }
+    memory_fastest_copy(old_kpage, new_kpage, PGSIZE);     // Defined in memoryCopy.s.
+  }
+
+  if (new_kpage != NULL) {
+    palloc_free_page(new_kpage);
+  }
+  return true;
+}
+
+/* Makes AS the address space of the first 1 GB, or the kernel table if AS is NULL. It is called
+   by thread_schedule_tail() when the next thread belongs to another process, so it doesn't take
+   locks or allocate memory. Interrupts must be off. */
+void mmu_address_space_activate(struct address_space *as) {
+  ASSERT (interrupts_get_level() == INTERRUPTS_OFF);
+
+  if (as == NULL) {
+    mmu_switch_address_space(translation_table, 0);   // Defined in mmu.s.
+    current_address_space = NULL;
+    return;
+  }
+
+  if (as->asid_generation != asid_generation) {
+    if (next_asid > MMU_ASID_MAX) {
+      /* New generation: the old ASIDs may be in the TLB. */
+      asid_generation++;
+      next_asid = 1;
+      mmu_invalidate_tlb();
+    }
+    as->asid = next_asid++;
+    as->asid_generation = asid_generation;
+  }
+
+  mmu_switch_address_space(as->table, as->asid);      // Defined in mmu.s.
+  current_address_space = as;
+}
+
+/* Maps the user page UPAGE of AS to the kernel page KPAGE. The page is read-only unless
+   WRITABLE. Returns false if there is no memory for the coarse table.
+
+   KPAGE should come from the user pool (palloc_get_page(PAL_USER)). It is released by
+   mmu_address_space_destroy(). */
+bool mmu_map_user_page(struct address_space *as, void *upage, void *kpage, bool writable) {
+  ASSERT (as != NULL);
+  ASSERT (pg_ofs(upage) == 0 && pg_ofs(kpage) == 0);
+  ASSERT ((uintptr_t) upage >= MMU_USER_BASE && (uintptr_t) upage < MMU_USER_TOP);
+
+  enum interrupts_level old_level;
+  if (!mmu_page_table_reserve(&old_level)) {
+    return false;
+  }
+  uint32_t *entry = mmu_create_user_page(as, upage);
+  *entry = mmu_user_page_entry(kpage, writable);
+  cache_clean_line(entry);
+  mmu_invalidate_user_page(as, upage);
+  interrupts_set_level(old_level);
+
+  return true;
+}
+
+/* Reserves the PAGE_CNT user pages starting at UPAGE in AS, without memory. Each page gets a
+   zeroed page the first time it is accessed: the access causes a data abort that is resolved by
+   mmu_map_demand_page(). Returns false if there is no memory for the coarse tables. Only the
+   coarse tables are allocated, so it doesn't depend on the number of pages.
+
+   The pages that are already mapped are not changed. */
+bool mmu_reserve_user_pages(struct address_space *as, void *upage, size_t page_cnt,
+    bool writable) {
+  uint8_t *page = upage;
+  size_t i;
+
+  ASSERT (as != NULL);
+  ASSERT (pg_ofs(upage) == 0);
+  ASSERT ((uintptr_t) upage >= MMU_USER_BASE
+      && page_cnt <= (MMU_USER_TOP - (uintptr_t) upage) / PGSIZE);
+
+  for (i = 0; i < page_cnt; i++, page += PGSIZE) {
+    enum interrupts_level old_level;
+    if (!mmu_page_table_reserve(&old_level)) {
+      return false;
+    }
+    uint32_t *entry = mmu_create_user_page(as, page);
+    if (!(*entry & PAGE_TYPE)) {
+      *entry = LAZY_ZERO | (writable ? LAZY_WRITABLE : 0);
+    }
+    interrupts_set_level(old_level);
+  }
+
+  return true;
+}
+
+/* Returns true if FAULT_ADDRESS is in a page of the active address space that was reserved by
+   mmu_reserve_user_pages() and is still not mapped. It is called by the data abort handler, so
+   it doesn't take locks or allocate memory. */
+bool mmu_is_demand_fault(const void *fault_address) {
+  uint32_t *entry;
+
+  if (current_address_space == NULL) {
+    return false;
+  }
+  entry = mmu_lookup_user_page(current_address_space, fault_address);
+  return entry != NULL && (*entry & (PAGE_TYPE | LAZY_ZERO)) == LAZY_ZERO;
+}
+
+/* Maps a zeroed page of the user pool at the reserved page that contains FAULT_ADDRESS, in the
+   active address space. It runs in the thread that caused the fault (see data_abort_resolve in
+   interruptsHandlers.s). Returns false if there is no memory. */
+bool mmu_map_demand_page(const void *fault_address) {
+  void *upage = pg_round_down(fault_address);
+  void *kpage = palloc_get_page(PAL_USER | PAL_ZERO);
+  struct address_space *as;
+  bool mapped = false;
+
+  if (kpage == NULL) {
+    return false;
+  }
+
+  enum interrupts_level old_level = interrupts_disable();
+  as = current_address_space;
+  if (as != NULL) {
+    uint32_t *entry = mmu_lookup_user_page(as, upage);
+    if (entry != NULL && (*entry & (PAGE_TYPE | LAZY_ZERO)) == LAZY_ZERO) {
+      *entry = mmu_user_page_entry(kpage, *entry & LAZY_WRITABLE);
+      cache_clean_line(entry);
+      mmu_invalidate_user_page(as, upage);
+      mapped = true;
+    }
+  }
+  interrupts_set_level(old_level);
+
+  if (!mapped) {
+    /* Another thread of the process mapped it first. */
+    palloc_free_page(kpage);
+  }
+  return true;
+}
+
+/* Returns the kernel address of the byte mapped at the user address UADDR of AS, or NULL if
+   UADDR is not mapped. */
+void *mmu_get_user_page(struct address_space *as, const void *uaddr) {
+  uint32_t *entry = mmu_lookup_user_page(as, uaddr);
+
+  if (entry == NULL || !(*entry & PAGE_TYPE)) {
+    return NULL;
+  }
+  return (void *) (PAGE_ADDRESS(*entry) + pg_ofs(uaddr));
+}
+
+/* Unmaps the user page UPAGE of AS, so the next access faults. The page is not released. */
+void mmu_unmap_user_page(struct address_space *as, void *upage) {
+  ASSERT (pg_ofs(upage) == 0);
+
+  enum interrupts_level old_level = interrupts_disable();
+  uint32_t *entry = mmu_lookup_user_page(as, upage);
+  if (entry != NULL && (*entry & PAGE_TYPE)) {
+    *entry = 0;
+    cache_clean_line(entry);
+    mmu_invalidate_user_page(as, upage);
+  }
+  interrupts_set_level(old_level);
+}
+
+/* Returns the entry of the user page UPAGE of AS, creating the coarse table of its section if it
+   doesn't exist. Interrupts must be off, after mmu_page_table_reserve(). */
+static uint32_t *mmu_create_user_page(struct address_space *as, const void *upage) {
+  uint32_t section = (uintptr_t) upage / MMU_SECTION_SIZE;
+  uint32_t *page_table;
+
+  if ((as->table[section] & SECTION_MASK) == COARSE_TYPE) {
+    page_table = (uint32_t *) (as->table[section] & ~(PAGE_TABLE_SIZE - 1));
+  } else {
+    page_table = mmu_page_table_alloc();
+    memset(page_table, 0, PAGE_TABLE_SIZE);     /* Every page unmapped (fault entries). */
+    cache_clean_range(page_table, PAGE_TABLE_SIZE);
+    as->table[section] = (uint32_t) page_table | COARSE_TYPE;
+    cache_clean_line(&as->table[section]);
+  }
+
+  return &page_table[((uintptr_t) upage % MMU_SECTION_SIZE) / PGSIZE];
+}
+
+/* Returns the small page entry that maps a user page to KPAGE, read-only unless WRITABLE. */
+static uint32_t mmu_user_page_entry(void *kpage, bool writable) {
+  return (uintptr_t) kpage | PAGE_TYPE | PAGE_NG | PAGE_TEX(1) | PAGE_C | PAGE_B
+      | (writable ? PAGE_AP_USER_RW : PAGE_AP_USER_RO);
+}
+
+/* Returns true if ENTRY maps a page shared by copy-on-write. */
+static bool mmu_is_copy_on_write_entry(uint32_t entry) {
+  return (entry & PAGE_TYPE) && (entry & PAGE_AP_MASK) == PAGE_AP_COW;
+}
+
+/* Returns the entry of the user page that contains UADDR, or NULL if its section has no table. */
+static uint32_t *mmu_lookup_user_page(struct address_space *as, const void *uaddr) {
+  uint32_t section = (uintptr_t) uaddr / MMU_SECTION_SIZE;
+
+  ASSERT (as != NULL);
+  if ((uintptr_t) uaddr < MMU_USER_BASE || (uintptr_t) uaddr >= MMU_USER_TOP
+      || (as->table[section] & SECTION_MASK) != COARSE_TYPE) {
+    return NULL;
+  }
+
+  uint32_t *page_table = (uint32_t *) (as->table[section] & ~(PAGE_TABLE_SIZE - 1));
+  return &page_table[((uintptr_t) uaddr % MMU_SECTION_SIZE) / PGSIZE];
+}
+
+/* Invalidates the TLB entry of the user page UPAGE of AS. If AS has no ASID in the current
+   generation, none of its entries can be in the TLB. */
+static void mmu_invalidate_user_page(struct address_space *as, void *upage) {
+  if (as->asid_generation == asid_generation) {
+    mmu_invalidate_tlb_entry((uintptr_t) upage | as->asid);   // Defined in mmu.s.
+  }
+}
+
+/* Number of address space switches done by mmu_address_space_benchmark(). */
+#define BENCHMARK_SWITCHES 10000
+
+/* Compares switching between two user address spaces (a process switch) against switching to
+   the kernel table (what a switch between kernel threads would do). Every iteration reads a
+   word of a user page, to show that the TLB entries survive the switches. Prints the elapsed
+   system timer ticks (microseconds). */
+void mmu_address_space_benchmark(void) {
+  struct address_space *as[2];
+  void *upage = (void *) MMU_USER_BASE;
+  int start, kernel_time, process_time;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    void *kpage = palloc_get_page(PAL_USER | PAL_ZERO);
+    as[i] = mmu_address_space_create();
+    if (kpage == NULL || as[i] == NULL || !mmu_map_user_page(as[i], upage, kpage, true)) {
+      /* KPAGE is not mapped, so destroying the address spaces doesn't release it. */
+      if (kpage != NULL) {
+        palloc_free_page(kpage);
+      }
+      if (as[i] != NULL) {
+        mmu_address_space_destroy(as[i]);
+      }
+      if (i == 1) {
+        mmu_address_space_destroy(as[0]);
+      }
+      printf("\nAddress space benchmark: out of memory");
+      return;
+    }
+  }
+
+  enum interrupts_level old_level = interrupts_disable();
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_SWITCHES; i++) {
+    mmu_address_space_activate(NULL);
+  }
+  kernel_time = timer_get_timestamp() - start;
+
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_SWITCHES; i++) {
+    mmu_address_space_activate(as[i % 2]);
+    *(volatile uint32_t *) upage;
+  }
+  process_time = timer_get_timestamp() - start;
+
+  mmu_address_space_activate(NULL);
+  interrupts_set_level(old_level);
+
+  mmu_address_space_destroy(as[0]);
+  mmu_address_space_destroy(as[1]);
+
+  printf("\nAddress space benchmark: %d switches", BENCHMARK_SWITCHES);
+  printf("\n  kernel table:    %d us", kernel_time);
+  printf("\n  user processes:  %d us", process_time);
+}
+
+/* Returns the attribute bits of a small page entry that maps memory like the SECTION_ENTRY.
+   The fields are the same, but they are in different bits:
+
+      Section:     nG[17] S[16] APX[15] TEX[14:12] AP[11:10] XN[4] C[3] B[2]
+      Small page:  nG[11] S[10] APX[9]  TEX[8:6]   AP[5:4]   XN[0] C[3] B[2] */
+static uint32_t mmu_page_attributes(uint32_t section_entry) {
+  uint32_t attributes = PAGE_TYPE | (section_entry & (SECTION_C | SECTION_B));
+
+  attributes |= (section_entry >> 6) & (0xff << 4);   /* AP, TEX, APX, S and nG. */
+  if (section_entry & SECTION_XN) {
+    attributes |= PAGE_XN;
+  }
+
+  return attributes;
+}
+
+/* Returns the attribute bits of a section entry for the memory type TYPE. */
+static uint32_t mmu_section_attributes(enum mmu_memory_type type) {
+  uint32_t attributes = SECTION_TYPE | SECTION_AP_KERNEL;
+
+  switch (type) {
+    case MMU_MEMORY_NORMAL:
+      /* TEX = 0b001, C = 1, B = 1: Outer and inner write-back, write-allocate. */
+      return attributes | SECTION_TEX(1) | SECTION_C | SECTION_B;
+    case MMU_MEMORY_WRITE_COMBINE:
+      /* TEX = 0b001, C = 0, B = 0: Outer and inner non-cacheable. The stores to consecutive
+         addresses are merged in the write buffer and sent to memory as bursts. */
+      return attributes | SECTION_TEX(1);
+    case MMU_MEMORY_DEVICE:
+      /* TEX = 0b000, C = 0, B = 1: Shared device. */
+      return attributes | SECTION_B | SECTION_XN;
+    case MMU_MEMORY_STRONGLY_ORDERED:
+    default:
+      /* TEX = 0b000, C = 0, B = 0: Strongly ordered. */
+      return attributes | SECTION_XN;
+  }
+}
+
+/* Size of the sparse buffer of mmu_demand_paging_benchmark() and pages of it that are touched. */
+#define BENCHMARK_BUFFER_PAGES 256
+#define BENCHMARK_TOUCHED_PAGES 8
+
+/* Compares a sparse buffer of BENCHMARK_BUFFER_PAGES pages allocated up front (zeroed and mapped)
+   against the same buffer reserved for demand paging, when only BENCHMARK_TOUCHED_PAGES of its
+   pages are written. Prints the elapsed system timer ticks (microseconds) and the pages of the
+   user pool in use (resident) for both. It runs with the address space of the current thread
+   replaced by a temporary one. */
+void mmu_demand_paging_benchmark(void) {
+  struct thread *cur = thread_current();
+  struct address_space *old_as = cur->address_space;
+  struct palloc_stats before, after;
+  int start, eager_time, lazy_time;
+  uint32_t eager_pages, lazy_pages;
+  uint8_t *buffer = (uint8_t *) MMU_USER_BASE;
+  int i;
+
+  /* Allocated up front. */
+  struct address_space *as = mmu_address_space_create();
+  if (as == NULL) {
+    printf("\nDemand paging benchmark: out of memory");
+    return;
+  }
+  mmu_benchmark_switch(cur, as);
+  palloc_get_stats(PAL_USER, &before);
+  start = timer_get_timestamp();
+  uint8_t *kpages = palloc_get_multiple(PAL_USER | PAL_ZERO, BENCHMARK_BUFFER_PAGES);
+  if (kpages == NULL) {
+    printf("\nDemand paging benchmark: out of memory");
+    mmu_benchmark_switch(cur, old_as);
+    mmu_address_space_destroy(as);
+    return;
+  }
+  for (i = 0; i < BENCHMARK_BUFFER_PAGES; i++) {
+    if (!mmu_map_user_page(as, buffer + i * PGSIZE, kpages + i * PGSIZE, true)) {
+      /* The pages mapped so far are released with AS. */
+      printf("\nDemand paging benchmark: out of memory");
+      palloc_free_multiple(kpages + i * PGSIZE, BENCHMARK_BUFFER_PAGES - i);
+      mmu_benchmark_switch(cur, old_as);
+      mmu_address_space_destroy(as);
+      return;
+    }
+  }
+  for (i = 0; i < BENCHMARK_TOUCHED_PAGES; i++) {
+    buffer[i * (BENCHMARK_BUFFER_PAGES / BENCHMARK_TOUCHED_PAGES) * PGSIZE] = 1;
+  }
+  eager_time = timer_get_timestamp() - start;
+  palloc_get_stats(PAL_USER, &after);
+  eager_pages = after.used_cnt - before.used_cnt;
+  mmu_benchmark_switch(cur, old_as);
+  mmu_address_space_destroy(as);
+
+  /* Demand paging. */
+  as = mmu_address_space_create();
+  if (as == NULL) {
+    printf("\nDemand paging benchmark: out of memory");
+    return;
+  }
+  mmu_benchmark_switch(cur, as);
+  palloc_get_stats(PAL_USER, &before);
+  start = timer_get_timestamp();
+  if (!mmu_reserve_user_pages(as, buffer, BENCHMARK_BUFFER_PAGES, true)) {
+    printf("\nDemand paging benchmark: out of memory");
+    mmu_benchmark_switch(cur, old_as);
+    mmu_address_space_destroy(as);
+    return;
+  }
+  for (i = 0; i < BENCHMARK_TOUCHED_PAGES; i++) {
+    buffer[i * (BENCHMARK_BUFFER_PAGES / BENCHMARK_TOUCHED_PAGES) * PGSIZE] = 1;
+  }
+  lazy_time = timer_get_timestamp() - start;
+  palloc_get_stats(PAL_USER, &after);
+  lazy_pages = after.used_cnt - before.used_cnt;
+  mmu_benchmark_switch(cur, old_as);
+  mmu_address_space_destroy(as);
+
+  printf("\nDemand paging benchmark: %d pages, %d touched", BENCHMARK_BUFFER_PAGES,
+      BENCHMARK_TOUCHED_PAGES);
+  printf("\n  up front: %d us, %d resident pages", eager_time, (int) eager_pages);
+  printf("\n  demand:   %d us, %d resident pages", lazy_time, (int) lazy_pages);
+}
+
+/* Makes AS the address space of the thread CUR and activates it. */
+static void mmu_benchmark_switch(struct thread *cur, struct address_space *as) {
+  enum interrupts_level old_level = interrupts_disable();
+  cur->address_space = as;
+  mmu_address_space_activate(as);
+  interrupts_set_level(old_level);
+}
+
+/* Number of resident pages of the address space cloned by mmu_clone_benchmark(). */
+#define BENCHMARK_CLONE_PAGES 64
+
+/* Compares cloning an address space with BENCHMARK_CLONE_PAGES resident pages by copy-on-write
+   against copying all its pages, and measures the first write to a shared page (a copy-on-write
+   fault). Prints the elapsed system timer ticks (microseconds). It runs with the address space of
+   the current thread replaced by a temporary one. */
+void mmu_clone_benchmark(void) {
+  struct thread *cur = thread_current();
+  struct address_space *old_as = cur->address_space;
+  struct address_space *parent, *child;
+  uint8_t *buffer = (uint8_t *) MMU_USER_BASE;
+  int start, copy_time, clone_time, fault_time;
+  bool success = true;
+  int i;
+
+  parent = mmu_address_space_create();
+  if (parent == NULL) {
+    printf("\nClone benchmark: out of memory");
+    return;
+  }
+  mmu_benchmark_switch(cur, parent);
+  if (!mmu_reserve_user_pages(parent, buffer, BENCHMARK_CLONE_PAGES, true)) {
+    success = false;
+  }
+  for (i = 0; success && i < BENCHMARK_CLONE_PAGES; i++) {
+    buffer[i * PGSIZE] = i;                   /* Makes the page resident. */
+  }
+
+  /* Copying every page. */
+  start = timer_get_timestamp();
+  child = success ? mmu_address_space_create() : NULL;
+  for (i = 0; child != NULL && i < BENCHMARK_CLONE_PAGES; i++) {
+    void *kpage = palloc_get_page(PAL_USER);
+    if (kpage == NULL) {
+      success = false;
+      break;
+    }
+    memory_fastest_copy(mmu_get_user_page(parent, buffer + i * PGSIZE), kpage, PGSIZE);
+    if (!mmu_map_user_page(child, buffer + i * PGSIZE, kpage, true)) {
+      palloc_free_page(kpage);
+      success = false;
+      break;
+    }
+  }
+  copy_time = timer_get_timestamp() - start;
+  if (child != NULL) {
+    mmu_address_space_destroy(child);
+  }
+
+  /* Copy-on-write. */
+  start = timer_get_timestamp();
+  child = success ? mmu_address_space_clone(parent) : NULL;
+  clone_time = timer_get_timestamp() - start;
+  start = timer_get_timestamp();
+  if (child != NULL) {
+    buffer[0] = 1;                            /* Copy-on-write fault. */
+  }
+  fault_time = timer_get_timestamp() - start;
+
+  mmu_benchmark_switch(cur, old_as);
+  if (child != NULL) {
+    mmu_address_space_destroy(child);
+  }
+  mmu_address_space_destroy(parent);
+
+  if (child == NULL) {
+    printf("\nClone benchmark: out of memory");
+    return;
+  }
+  printf("\nClone benchmark: %d resident pages", BENCHMARK_CLONE_PAGES);
+  printf("\n  copy:            %d us", copy_time);
+  printf("\n  copy-on-write:   %d us", clone_time);
+  printf("\n  first write:     %d us", fault_time);
+}
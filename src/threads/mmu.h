@@ -0,0 +1,76 @@
+/*
+ * mmu.h
+ *
+ * Configures the MMU (Memory Management Unit) of the ARM1176JZF-S with an identity mapping of the
+ * whole address space, so the data cache can be enabled.
+ */
+
+#ifndef THREADS_MMU_H_
+#define THREADS_MMU_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of a section, the unit mapped by an entry of the first level translation table. */
+#define MMU_SECTION_SIZE (1 << 20)     /* 1 MB */
+
+/* Virtual addresses of the user processes. TTBR0 translates the first 1 GB, so every process has
+   its own table for it; the kernel entries below MMU_USER_BASE are copied into every table. */
+#define MMU_USER_BASE 0x30000000
+#define MMU_USER_TOP  0x40000000
+
+/* Address space of a user process. */
+struct address_space;
+
+/* Memory type of a mapping. */
+enum mmu_memory_type {
+  MMU_MEMORY_NORMAL,            /* RAM. Cacheable write-back, write-allocate. */
+  MMU_MEMORY_WRITE_COMBINE,     /* Uncached, but the writes are merged in the write buffer. */
+  MMU_MEMORY_DEVICE,            /* Peripherals. Uncached, bufferable, never executed. */
+  MMU_MEMORY_STRONGLY_ORDERED   /* Uncached and unbuffered, never executed. */
+};
+
+/* Builds the identity translation table and enables the MMU, the caches and the branch
+   prediction. It is called by start.s before main(). */
+void mmu_init(void);
+
+/* Sets the memory type of the sections that contain the SIZE bytes starting at START. */
+void mmu_set_memory_type(void *start, size_t size, enum mmu_memory_type type);
+
+/* Unmaps the 4 KB page PAGE, so any access to it causes a data abort. Returns false if there
+   wasn't memory for the second level table. */
+bool mmu_unmap_page(void *page);
+
+/* Maps again the 4 KB page PAGE that was unmapped by mmu_unmap_page(). */
+void mmu_remap_page(void *page);
+
+/* User address spaces. */
+struct address_space *mmu_address_space_create(void);
+void mmu_address_space_destroy(struct address_space *as);
+void mmu_address_space_activate(struct address_space *as);
+bool mmu_map_user_page(struct address_space *as, void *upage, void *kpage, bool writable);
+void *mmu_get_user_page(struct address_space *as, const void *uaddr);
+void mmu_unmap_user_page(struct address_space *as, void *upage);
+bool mmu_reserve_user_pages(struct address_space *as, void *upage, size_t page_cnt,
+    bool writable);
+bool mmu_is_demand_fault(const void *fault_address);
+bool mmu_map_demand_page(const void *fault_address);
+struct address_space *mmu_address_space_clone(struct address_space *parent);
+bool mmu_is_copy_on_write_fault(const void *fault_address);
+bool mmu_copy_on_write(const void *fault_address);
+void mmu_address_space_benchmark(void);
+void mmu_demand_paging_benchmark(void);
+void mmu_clone_benchmark(void);
+
+/* Cache maintenance for memory shared with the GPU (VideoCore). Defined in mmu.s. */
+
+/* Writes to memory the dirty data cache lines of the SIZE bytes starting at START. Call it
+   after writing memory that the GPU is going to read. */
+extern void cache_clean_range(const void *start, size_t size);
+
+/* Discards the data cache lines of the SIZE bytes starting at START. Call it before reading
+   memory that the GPU wrote. START and SIZE should be aligned to 32 bytes (a cache line). */
+extern void cache_invalidate_range(void *start, size_t size);
+
+#endif /* THREADS_MMU_H_ */
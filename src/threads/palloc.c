@@ -10,9 +10,14 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "interrupt.h"
 #include "vaddr.h"
 #include "synch.h"
 
+/* Fills SIZE bytes at DEST with zeros using store-multiple instructions. SIZE has to be a
+   multiple of 32. The function is defined in memoryCopy.s. */
+extern void memory_fast_zero(void *dest, int size);
+
 /* Page allocator. Hands out memory in page-size (or page-multiple) chunks. See malloc.h for an
    allocator that hands out smaller chunks.
 
@@ -22,6 +27,11 @@
 
   By default, half of system RAM is given to the kernel pool and half to the user pool. That should
   be huge overkill for the kernel pool, but that's just fine for demonstration purposes.
+
+  Single zeroed kernel pages (thread stacks, for example) are served from a small cache of pages
+  that the idle thread zeroes in advance, see palloc_refill_zeroed_pages(). Pages in the cache are
+  marked as used in the kernel pool bitmap, but the statistics count them apart from the used
+  pages until they are handed out.
  */
 
 /* A memory pool. */
@@ -29,14 +39,33 @@ struct pool {
   struct lock lock;             /* Mutual exclusion. */
   struct bitmap *used_map;      /* Bitmap of free pages. */
   uint8_t *base;                /* Base of pool. */
+  const char *name;             /* Name (for statistics). */
+
+  /* Statistics. Updated with the interrupts disabled because pages are also freed from
+     thread_schedule_tail(), where the pool lock can't be taken. */
+  size_t used_cnt;              /* Number of used pages, without the pre-zeroed cache. */
+  size_t peak_used_cnt;         /* Highest value of used_cnt. */
+  size_t failure_cnt;           /* Number of failed allocations. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool;
 static struct pool user_pool;
 
+/* Maximum number of pre-zeroed pages kept in the cache. */
+#define ZEROED_PAGES_MAX 16
+
+/* Cache of pre-zeroed kernel pages. Accessed with the interrupts disabled. */
+static void *zeroed_pages[ZEROED_PAGES_MAX];
+static size_t zeroed_page_cnt;
+
 static void init_pool (struct pool *, uint8_t *base, size_t page_cnt, const char *name);
+static void *zeroed_pages_pop (void);
 static bool page_from_pool (const struct pool *, void *page);
+static struct pool *pool_from_page (void *page);
+static void pool_count_pages (struct pool *, size_t page_cnt, bool used);
+static void pool_count_failure (struct pool *);
+static size_t pool_largest_free_run (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT pages are put into the user pool. */
 void palloc_init (size_t user_page_limit) {
@@ -56,36 +85,51 @@ void palloc_init (size_t user_page_limit) {
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  zeroed_page_cnt = 0;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages. If PAL_USER is set, the pages
    are obtained from the user pool, otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are available, returns a null pointer,
-   unless PAL_ASSERT is set in FLAGS, in which case the kernel panics. */
+   unless PAL_ASSERT is set in FLAGS, in which case the kernel panics. Single kernel pages
+   requested with PAL_ZERO are served from the pre-zeroed cache when it is not empty. */
 void * palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  bool from_cache = page_cnt == 1 && pool == &kernel_pool;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
+  /* Zeroed kernel pages are taken from the pre-zeroed cache first. */
+  if (from_cache && (flags & PAL_ZERO)) {
+    pages = zeroed_pages_pop ();
+    if (pages != NULL)
+      return pages;
+  }
+
   lock_acquire (&pool->lock);
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
   lock_release (&pool->lock);
 
-  if (page_idx != BITMAP_ERROR)
+  if (page_idx != BITMAP_ERROR) {
     pages = pool->base + PGSIZE * page_idx;
+    pool_count_pages (pool, page_cnt, true);
+  }
+  else if (from_cache)
+    pages = zeroed_pages_pop ();  /* The pool is exhausted, fall back to the cache. */
   else
     pages = NULL;
 
   if (pages != NULL)
     {
       if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
+        memory_fast_zero (pages, PGSIZE * page_cnt);
     }
   else
     {
+      pool_count_failure (pool);
       if (flags & PAL_ASSERT)
         PANIC ("palloc_get: out of pages");
     }
@@ -106,25 +150,24 @@ void palloc_free_multiple (void *pages, size_t page_cnt) {
   struct pool *pool;
   size_t page_idx;
 
-  ASSERT (pg_ofs (pages) == 0);
+  ALLOC_ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
+  pool = pool_from_page (pages);
   page_idx = pg_no (pages) - pg_no (pool->base);
 
-#ifndef NDEBUG
+#ifdef ALLOCATOR_DEBUG
+  /* Pages that are not all in use are being freed twice. */
+  if (!bitmap_all (pool->used_map, page_idx, page_cnt))
+    PANIC ("palloc_free: double free");
+
+  /* Poison the pages to help detect use-after-free bugs. */
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  pool_count_pages (pool, page_cnt, false);
 }
 
 /* Frees the page at PAGE. */
@@ -132,6 +175,114 @@ void palloc_free_page (void *page) {
   palloc_free_multiple (page, 1);
 }
 
+/* Tops up the cache of pre-zeroed kernel pages. It is called by the idle thread, so the zeroing
+   runs while the CPU would otherwise be unused instead of in palloc_get_page(PAL_ZERO). It never
+   sleeps: if the kernel pool is busy, the refill is skipped until the idle thread runs again. */
+void palloc_refill_zeroed_pages (void) {
+  enum interrupts_level old_level;
+  size_t page_idx;
+  void *page;
+
+  while (zeroed_page_cnt < ZEROED_PAGES_MAX) {
+    if (!lock_try_acquire (&kernel_pool.lock))
+      return;
+    page_idx = bitmap_scan_and_flip (kernel_pool.used_map, 0, 1, false);
+    lock_release (&kernel_pool.lock);
+
+    if (page_idx == BITMAP_ERROR)
+      return;
+
+    /* Counted as used when it is handed out, by zeroed_pages_pop(). */
+    page = kernel_pool.base + PGSIZE * page_idx;
+    memory_fast_zero (page, PGSIZE);
+
+    old_level = interrupts_disable ();
+    zeroed_pages[zeroed_page_cnt++] = page;
+    interrupts_set_level (old_level);
+  }
+}
+
+/* Resizes the run of PAGE_CNT pages starting at PAGES to NEW_PAGE_CNT pages without moving it.
+   Shrinking always succeeds and frees the pages past the new end.  Growing succeeds only if
+   the pages that immediately follow the run are free and belong to the same pool, in which
+   case they are marked as used and true is returned.  Otherwise the run is left untouched and
+   false is returned. */
+bool palloc_resize_multiple (void *pages, size_t page_cnt, size_t new_page_cnt) {
+  struct pool *pool;
+  size_t page_idx;
+  bool success;
+
+  ALLOC_ASSERT (pages != NULL);
+  ALLOC_ASSERT (pg_ofs (pages) == 0);
+  ALLOC_ASSERT (page_cnt > 0 && new_page_cnt > 0);
+
+  if (new_page_cnt <= page_cnt) {
+    palloc_free_multiple ((uint8_t *) pages + PGSIZE * new_page_cnt, page_cnt - new_page_cnt);
+    return true;
+  }
+
+  pool = pool_from_page (pages);
+  page_idx = pg_no (pages) - pg_no (pool->base);
+  if (page_idx + new_page_cnt > bitmap_size (pool->used_map))
+    return false;
+
+  lock_acquire (&pool->lock);
+  success = bitmap_none (pool->used_map, page_idx + page_cnt, new_page_cnt - page_cnt);
+  if (success)
+    bitmap_set_multiple (pool->used_map, page_idx + page_cnt, new_page_cnt - page_cnt, true);
+  lock_release (&pool->lock);
+
+  if (success)
+    pool_count_pages (pool, new_page_cnt - page_cnt, true);
+
+  return success;
+}
+
+/* Returns the first page of the user pool if PAL_USER is set in FLAGS, otherwise of the kernel
+   pool, and stores its number of pages in PAGE_CNT. */
+void *palloc_get_pool_base (enum palloc_flags flags, size_t *page_cnt) {
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  *page_cnt = bitmap_size (pool->used_map);
+  return pool->base;
+}
+
+/* Fills STATS with the statistics of the user pool if PAL_USER is set in FLAGS, otherwise with
+   the statistics of the kernel pool. */
+void palloc_get_stats (enum palloc_flags flags, struct palloc_stats *stats) {
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  enum interrupts_level old_level;
+
+  stats->page_cnt = bitmap_size (pool->used_map);
+  stats->largest_free_run = pool_largest_free_run (pool);
+
+  old_level = interrupts_disable ();
+  stats->used_cnt = pool->used_cnt;
+  stats->peak_used_cnt = pool->peak_used_cnt;
+  stats->failure_cnt = pool->failure_cnt;
+  stats->zeroed_cnt = pool == &kernel_pool ? zeroed_page_cnt : 0;
+  interrupts_set_level (old_level);
+}
+
+/* Prints page allocator statistics. */
+void palloc_print_stats (void) {
+  struct palloc_stats stats;
+  enum palloc_flags flags[] = { 0, PAL_USER };
+  size_t i;
+
+  for (i = 0; i < sizeof flags / sizeof *flags; i++) {
+    struct pool *pool = flags[i] & PAL_USER ? &user_pool : &kernel_pool;
+
+    palloc_get_stats (flags[i], &stats);
+    printf ("\nPalloc %s: %u/%u pages used (peak %u), %u free, largest free run %u, "
+            "%u failures, %u pre-zeroed",
+            pool->name, stats.used_cnt, stats.page_cnt, stats.peak_used_cnt,
+            stats.page_cnt - stats.used_cnt - stats.zeroed_cnt, stats.largest_free_run,
+            stats.failure_cnt, stats.zeroed_cnt);
+  }
+}
+
 /* Initializes pool P as starting at START and ending at END, naming it NAME for debugging
    purposes. */
 static void init_pool (struct pool *p, uint8_t *base, size_t page_cnt, const char *name) {
@@ -142,12 +293,88 @@ static void init_pool (struct pool *p, uint8_t *base, size_t page_cnt, const cha
     PANIC ("Not enough memory in for bitmap.");
   page_cnt -= bm_pages;
 
-  //printf ("%zu pages available in %s.\n", page_cnt, name);
+  printf ("\n%zu pages available in %s.", page_cnt, name);
 
   /* Initialize the pool. */
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+  p->used_cnt = 0;
+  p->peak_used_cnt = 0;
+  p->failure_cnt = 0;
+}
+
+/* Adds PAGE_CNT pages to the used pages of POOL if USED is true, otherwise subtracts them. */
+static void pool_count_pages (struct pool *pool, size_t page_cnt, bool used) {
+  enum interrupts_level old_level = interrupts_disable ();
+  if (used) {
+    pool->used_cnt += page_cnt;
+    if (pool->used_cnt > pool->peak_used_cnt)
+      pool->peak_used_cnt = pool->used_cnt;
+  } else {
+    pool->used_cnt -= page_cnt;
+  }
+  interrupts_set_level (old_level);
+}
+
+/* Adds a failed allocation to the statistics of POOL. */
+static void pool_count_failure (struct pool *pool) {
+  enum interrupts_level old_level = interrupts_disable ();
+  pool->failure_cnt++;
+  interrupts_set_level (old_level);
+}
+
+/* Returns the length, in pages, of the longest run of free pages in POOL. That is the largest
+   allocation palloc_get_multiple() can currently satisfy. */
+static size_t pool_largest_free_run (struct pool *pool) {
+  size_t page_cnt = bitmap_size (pool->used_map);
+  size_t largest = 0;
+  size_t start = 0;
+
+  lock_acquire (&pool->lock);
+  while (start < page_cnt) {
+    size_t free_idx = bitmap_scan (pool->used_map, start, 1, false);
+    size_t used_idx;
+
+    if (free_idx == BITMAP_ERROR)
+      break;
+    used_idx = bitmap_scan (pool->used_map, free_idx, 1, true);
+    if (used_idx == BITMAP_ERROR)
+      used_idx = page_cnt;
+    if (used_idx - free_idx > largest)
+      largest = used_idx - free_idx;
+    start = used_idx;
+  }
+  lock_release (&pool->lock);
+
+  return largest;
+}
+
+/* Removes and returns a page from the pre-zeroed cache, or a null pointer if the cache is
+   empty. The page is counted as used from now on. */
+static void *zeroed_pages_pop (void) {
+  enum interrupts_level old_level;
+  void *page = NULL;
+
+  old_level = interrupts_disable ();
+  if (zeroed_page_cnt > 0) {
+    page = zeroed_pages[--zeroed_page_cnt];
+    pool_count_pages (&kernel_pool, 1, true);
+  }
+  interrupts_set_level (old_level);
+
+  return page;
+}
+
+/* Returns the pool that PAGE was allocated from. */
+static struct pool *pool_from_page (void *page) {
+  if (page_from_pool (&kernel_pool, page))
+    return &kernel_pool;
+  else if (page_from_pool (&user_pool, page))
+    return &user_pool;
+  else
+    NOT_REACHED ();
 }
 
 /* Returns true if PAGE was allocated from POOL, false otherwise. */
@@ -1,7 +1,19 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include <debug.h>
+
+/* Consistency checks of the memory allocators. They are only compiled into the debug allocator
+   build (ALLOCATOR_DEBUG, see the Makefile). */
+#ifdef ALLOCATOR_DEBUG
+#define ALLOC_ASSERT(CONDITION) ASSERT (CONDITION)
+#else
+#define ALLOC_ASSERT(CONDITION) ((void) 0)
+#endif
 
 /* How to allocate pages. */
 enum palloc_flags {
@@ -10,10 +22,25 @@ enum palloc_flags {
   PAL_USER = 004                /* User page. */
 };
 
+/* Statistics of a pool. Fixed-size fields, so it can be copied as a binary snapshot. */
+struct palloc_stats {
+  uint32_t page_cnt;            /* Pages managed by the pool. */
+  uint32_t used_cnt;            /* Pages in use, without the pre-zeroed cache. */
+  uint32_t peak_used_cnt;       /* Highest number of pages in use. */
+  uint32_t largest_free_run;    /* Longest run of contiguous free pages. */
+  uint32_t failure_cnt;         /* Allocations that failed. */
+  uint32_t zeroed_cnt;          /* Pages in the pre-zeroed cache (kernel pool only), not free. */
+};
+
 void palloc_init(size_t user_page_limit);
 void *palloc_get_page(enum palloc_flags);
 void *palloc_get_multiple(enum palloc_flags, size_t page_cnt);
 void palloc_free_page(void *);
 void palloc_free_multiple(void *, size_t page_cnt);
+bool palloc_resize_multiple(void *, size_t page_cnt, size_t new_page_cnt);
+void palloc_refill_zeroed_pages(void);
+void *palloc_get_pool_base(enum palloc_flags, size_t *page_cnt);
+void palloc_get_stats(enum palloc_flags, struct palloc_stats *);
+void palloc_print_stats(void);
 
 #endif /* THREADS_PALLOC_H */
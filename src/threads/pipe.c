@@ -0,0 +1,416 @@
+/*
+ * pipe.c
+ *
+ * Pipes between threads. A pipe is a bounded queue of pages: pipe_send_page() gives a page of the
+ * page allocator to the pipe and pipe_receive_page() gives it to the receiver, which owns it from
+ * then on (it releases it with palloc_free_page() or sends it again). The contents of the page
+ * are never copied, so the cost of a transfer doesn't depend on its size.
+ *
+ * The message queue functions build on top of it: pipe_write() appends small messages to a page
+ * of the pipe, and the page is queued when it is full or pipe_flush() is called. pipe_read()
+ * takes the messages out of the received pages one by one. When there are no queued pages, the
+ * reader takes the page that is being filled, so the messages don't wait for the page to fill.
+ * A pipe should be used either for pages or for messages, not for both.
+ *
+ * Every function can block (BLOCK true) or return at once when the pipe is full or empty. They
+ * take the lock of the pipe, so they can't be called from an interrupt handler.
+ */
+
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../devices/timer.h"
+#include "malloc.h"
+#include "palloc.h"
+#include "pipe.h"
+#include "synch.h"
+#include "thread.h"
+#include "vaddr.h"
+
+/* Number of pages that can be queued in a pipe. */
+#define PIPE_CAPACITY 16
+
+/* Header of every message in the pages of a message queue. The messages are aligned to words. */
+struct pipe_message {
+  uint32_t size;                /* Bytes of DATA. */
+  uint8_t data[];
+};
+
+/* Size of the message of SIZE bytes in the page, header included. */
+#define PIPE_MESSAGE_SPACE(SIZE) ROUND_UP(sizeof (struct pipe_message) + (SIZE), 4)
+
+/* Page queued in a pipe. */
+struct pipe_slot {
+  void *page;
+  size_t length;                /* Bytes used in the page. */
+};
+
+/* Pipe. */
+struct pipe {
+  struct lock lock;
+  struct condition not_empty;   /* Signaled when there is something to read. */
+  struct condition not_full;    /* Signaled when a queued page is taken. */
+  struct pipe_slot slots[PIPE_CAPACITY];    /* Circular queue of pages. */
+  size_t head;                  /* Index of the oldest queued page. */
+  size_t count;                 /* Number of queued pages. */
+
+  /* Message queue. */
+  uint8_t *write_page;          /* Page being filled by pipe_write(), or NULL. */
+  size_t write_length;          /* Bytes used in WRITE_PAGE. */
+  uint8_t *read_page;           /* Page being read by pipe_read(), or NULL. */
+  size_t read_length;           /* Bytes used in READ_PAGE. */
+  size_t read_ofs;              /* Offset of the next message in READ_PAGE. */
+  void *spare_page;             /* Page already read, kept for the next WRITE_PAGE. */
+};
+
+static bool pipe_push(struct pipe *pipe, void *page, size_t length, bool block);
+static bool pipe_push_write_page(struct pipe *pipe, bool block);
+static void *pipe_pop(struct pipe *pipe, size_t *length, bool block);
+static void pipe_recycle_page(struct pipe *pipe, void *page);
+
+/* Creates an empty pipe. Returns NULL if there is no memory. */
+struct pipe *pipe_create(void) {
+  struct pipe *pipe = malloc(sizeof *pipe);
+
+  if (pipe == NULL) {
+    return NULL;
+  }
+  lock_init(&pipe->lock);
+  cond_init(&pipe->not_empty);
+  cond_init(&pipe->not_full);
+  pipe->head = 0;
+  pipe->count = 0;
+  pipe->write_page = NULL;
+  pipe->write_length = 0;
+  pipe->read_page = NULL;
+  pipe->read_length = 0;
+  pipe->read_ofs = 0;
+  pipe->spare_page = NULL;
+
+  return pipe;
+}
+
+/* Destroys PIPE and releases the pages that are still in it. No thread can be waiting on it. */
+void pipe_destroy(struct pipe *pipe) {
+  ASSERT (pipe != NULL);
+  ASSERT (list_empty(&pipe->not_empty.waiters) && list_empty(&pipe->not_full.waiters));
+
+  for (; pipe->count > 0; pipe->count--) {
+    palloc_free_page(pipe->slots[pipe->head].page);
+    pipe->head = (pipe->head + 1) % PIPE_CAPACITY;
+  }
+  if (pipe->write_page != NULL) {
+    palloc_free_page(pipe->write_page);
+  }
+  if (pipe->read_page != NULL) {
+    palloc_free_page(pipe->read_page);
+  }
+  if (pipe->spare_page != NULL) {
+    palloc_free_page(pipe->spare_page);
+  }
+  free(pipe);
+}
+
+/* Queues the page PAGE, with LENGTH bytes of data, in PIPE. The pipe owns the page from now on.
+   If the pipe is full, waits for a free slot if BLOCK is true, or returns false otherwise (the
+   caller keeps the page). */
+bool pipe_send_page(struct pipe *pipe, void *page, size_t length, bool block) {
+  bool sent;
+
+  ASSERT (pipe != NULL);
+  ASSERT (page != NULL && pg_ofs(page) == 0);
+  ASSERT (length <= PGSIZE);
+
+  lock_acquire(&pipe->lock);
+  sent = pipe_push(pipe, page, length, block);
+  lock_release(&pipe->lock);
+
+  return sent;
+}
+
+/* Takes the oldest page of PIPE and stores its length in LENGTH. The caller owns the page and
+   releases it with palloc_free_page(). If the pipe is empty, waits for a page if BLOCK is true,
+   or returns NULL otherwise. */
+void *pipe_receive_page(struct pipe *pipe, size_t *length, bool block) {
+  void *page;
+
+  ASSERT (pipe != NULL);
+  ASSERT (length != NULL);
+
+  lock_acquire(&pipe->lock);
+  page = pipe_pop(pipe, length, block);
+  lock_release(&pipe->lock);
+
+  return page;
+}
+
+/* Appends the message of SIZE bytes (at most PIPE_MESSAGE_MAX) at MESSAGE to PIPE. The message is
+   copied into the page that is being filled, which is queued when there is no room for the next
+   message. Returns false if there is no memory, or if the pipe is full and BLOCK is false. */
+bool pipe_write(struct pipe *pipe, const void *message, size_t size, bool block) {
+  size_t space = PIPE_MESSAGE_SPACE(size);
+  struct pipe_message *header;
+
+  ASSERT (pipe != NULL);
+  ASSERT (message != NULL || size == 0);
+  ASSERT (size <= PIPE_MESSAGE_MAX);
+
+  lock_acquire(&pipe->lock);
+  if (pipe->write_page != NULL && pipe->write_length + space > PGSIZE
+      && !pipe_push_write_page(pipe, block)) {
+    lock_release(&pipe->lock);
+    return false;
+  }
+
+  if (pipe->write_page == NULL) {
+    pipe->write_page = pipe->spare_page != NULL ? pipe->spare_page : palloc_get_page(0);
+    pipe->spare_page = NULL;
+    pipe->write_length = 0;
+    if (pipe->write_page == NULL) {
+      lock_release(&pipe->lock);
+      return false;
+    }
+  }
+
+  header = (struct pipe_message *) (pipe->write_page + pipe->write_length);
+  header->size = size;
+  memcpy(header->data, message, size);
+  pipe->write_length += space;
+
+  cond_signal(&pipe->not_empty, &pipe->lock);
+  lock_release(&pipe->lock);
+
+  return true;
+}
+
+/* Queues the page that is being filled by pipe_write(), if it has any message. Returns false if
+   the pipe is full and BLOCK is false. */
+bool pipe_flush(struct pipe *pipe, bool block) {
+  bool flushed = true;
+
+  ASSERT (pipe != NULL);
+
+  lock_acquire(&pipe->lock);
+  if (pipe->write_page != NULL && pipe->write_length > 0) {
+    flushed = pipe_push_write_page(pipe, block);
+  }
+  lock_release(&pipe->lock);
+
+  return flushed;
+}
+
+/* Reads the oldest message of PIPE into BUFFER, which has room for SIZE bytes. The bytes of the
+   message that don't fit are discarded. Returns the size of the message, or -1 if there is no
+   message and BLOCK is false. */
+int pipe_read(struct pipe *pipe, void *buffer, size_t size, bool block) {
+  struct pipe_message *header;
+  size_t message_size;
+
+  ASSERT (pipe != NULL);
+  ASSERT (buffer != NULL || size == 0);
+
+  lock_acquire(&pipe->lock);
+  while (pipe->read_page == NULL || pipe->read_ofs == pipe->read_length) {
+    if (pipe->read_page != NULL) {
+      pipe_recycle_page(pipe, pipe->read_page);
+      pipe->read_page = NULL;
+    }
+
+    if (pipe->count > 0) {
+      pipe->read_page = pipe_pop(pipe, &pipe->read_length, false);
+      pipe->read_ofs = 0;
+    } else if (pipe->write_page != NULL && pipe->write_length > 0) {
+      /* Nothing queued: takes the messages of the page that is being filled. */
+      pipe->read_page = pipe->write_page;
+      pipe->read_length = pipe->write_length;
+      pipe->read_ofs = 0;
+      pipe->write_page = NULL;
+    } else if (block) {
+      cond_wait(&pipe->not_empty, &pipe->lock);
+    } else {
+      lock_release(&pipe->lock);
+      return -1;
+    }
+  }
+
+  header = (struct pipe_message *) (pipe->read_page + pipe->read_ofs);
+  message_size = header->size;
+  memcpy(buffer, header->data, message_size < size ? message_size : size);
+  pipe->read_ofs += PIPE_MESSAGE_SPACE(message_size);
+  lock_release(&pipe->lock);
+
+  return message_size;
+}
+
+/* Queues PAGE in PIPE, waiting for a free slot if BLOCK is true. Returns false if the pipe is
+   full and BLOCK is false. The lock of the pipe must be held. */
+static bool pipe_push(struct pipe *pipe, void *page, size_t length, bool block) {
+  struct pipe_slot *slot;
+
+  while (pipe->count == PIPE_CAPACITY) {
+    if (!block) {
+      return false;
+    }
+    cond_wait(&pipe->not_full, &pipe->lock);
+  }
+
+  slot = &pipe->slots[(pipe->head + pipe->count) % PIPE_CAPACITY];
+  slot->page = page;
+  slot->length = length;
+  pipe->count++;
+  cond_signal(&pipe->not_empty, &pipe->lock);
+
+  return true;
+}
+
+/* Queues the page that is being filled by pipe_write(), waiting for a free slot if BLOCK is true.
+   The page is detached from the pipe first: pipe_push() releases the lock while it waits, and
+   pipe_read() would take the page meanwhile. Returns false, and the page is still the one being
+   filled, if the pipe is full and BLOCK is false. The lock of the pipe must be held. */
+static bool pipe_push_write_page(struct pipe *pipe, bool block) {
+  uint8_t *page = pipe->write_page;
+  size_t length = pipe->write_length;
+
+  pipe->write_page = NULL;
+  pipe->write_length = 0;
+  if (!pipe_push(pipe, page, length, block)) {
+    pipe->write_page = page;
+    pipe->write_length = length;
+    return false;
+  }
+  return true;
+}
+
+/* Takes the oldest page of PIPE, waiting for one if BLOCK is true. Returns NULL if the pipe is
+   empty and BLOCK is false. The lock of the pipe must be held. */
+static void *pipe_pop(struct pipe *pipe, size_t *length, bool block) {
+  struct pipe_slot *slot;
+
+  while (pipe->count == 0) {
+    if (!block) {
+      return NULL;
+    }
+    cond_wait(&pipe->not_empty, &pipe->lock);
+  }
+
+  slot = &pipe->slots[pipe->head];
+  pipe->head = (pipe->head + 1) % PIPE_CAPACITY;
+  pipe->count--;
+  cond_signal(&pipe->not_full, &pipe->lock);
+
+  *length = slot->length;
+  return slot->page;
+}
+
+/* Keeps PAGE, already read, for the next page of pipe_write(), or releases it. The lock of the
+   pipe must be held. */
+static void pipe_recycle_page(struct pipe *pipe, void *page) {
+  if (pipe->spare_page == NULL) {
+    pipe->spare_page = page;
+  } else {
+    palloc_free_page(page);
+  }
+}
+
+/* Pages and messages transferred by pipe_benchmark(). */
+#define BENCHMARK_PAGES 1024
+#define BENCHMARK_MESSAGES 16384
+#define BENCHMARK_MESSAGE_SIZE 64
+
+static void pipe_benchmark_page_producer(void *pipe_);
+static void pipe_benchmark_message_producer(void *pipe_);
+static int pipe_benchmark_rate(int bytes, int time);
+
+/* Measures the throughput between two threads of copying every page with memcpy(), of passing
+   the pages through a pipe, and of small messages batched through a pipe. The current thread is
+   the consumer. Prints the elapsed system timer ticks (microseconds) and the throughput in MB/s. */
+void pipe_benchmark(void) {
+  int start, copy_time, page_time, message_time;
+  uint8_t message[BENCHMARK_MESSAGE_SIZE];
+  struct pipe *pipe;
+  uint8_t *pages;
+  int i;
+
+  pipe = pipe_create();
+  pages = palloc_get_multiple(PAL_ZERO, 2);
+  if (pipe == NULL || pages == NULL) {
+    printf("\nPipe benchmark: out of memory");
+    if (pipe != NULL) {
+      pipe_destroy(pipe);
+    }
+    return;
+  }
+
+  /* Copying. */
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_PAGES; i++) {
+    memcpy(pages + PGSIZE, pages, PGSIZE);
+  }
+  copy_time = timer_get_timestamp() - start;
+  palloc_free_multiple(pages, 2);
+
+  /* Page passing. */
+  start = timer_get_timestamp();
+  thread_create("Pipe producer", PRI_DEFAULT, pipe_benchmark_page_producer, pipe);
+  for (i = 0; i < BENCHMARK_PAGES; i++) {
+    size_t length;
+    uint32_t *page = pipe_receive_page(pipe, &length, true);
+    ASSERT (length == PGSIZE && page[0] == (uint32_t) i);
+    palloc_free_page(page);
+  }
+  page_time = timer_get_timestamp() - start;
+
+  /* Messages. */
+  start = timer_get_timestamp();
+  thread_create("Pipe producer", PRI_DEFAULT, pipe_benchmark_message_producer, pipe);
+  for (i = 0; i < BENCHMARK_MESSAGES; i++) {
+    int size = pipe_read(pipe, message, sizeof message, true);
+    ASSERT (size == BENCHMARK_MESSAGE_SIZE && message[0] == (uint8_t) i);
+  }
+  message_time = timer_get_timestamp() - start;
+
+  pipe_destroy(pipe);
+
+  printf("\nPipe benchmark: %d pages, %d messages of %d bytes", BENCHMARK_PAGES,
+      BENCHMARK_MESSAGES, BENCHMARK_MESSAGE_SIZE);
+  printf("\n  memcpy:        %d us, %d MB/s", copy_time,
+      pipe_benchmark_rate(BENCHMARK_PAGES * PGSIZE, copy_time));
+  printf("\n  page passing:  %d us, %d MB/s", page_time,
+      pipe_benchmark_rate(BENCHMARK_PAGES * PGSIZE, page_time));
+  printf("\n  messages:      %d us, %d MB/s", message_time,
+      pipe_benchmark_rate(BENCHMARK_MESSAGES * BENCHMARK_MESSAGE_SIZE, message_time));
+}
+
+/* Sends BENCHMARK_PAGES pages through the pipe PIPE_, numbered in their first word. */
+static void pipe_benchmark_page_producer(void *pipe_) {
+  struct pipe *pipe = pipe_;
+  int i;
+
+  for (i = 0; i < BENCHMARK_PAGES; i++) {
+    uint32_t *page = palloc_get_page(PAL_ASSERT);
+    page[0] = i;
+    pipe_send_page(pipe, page, PGSIZE, true);
+  }
+}
+
+/* Writes BENCHMARK_MESSAGES messages to the pipe PIPE_, numbered in their first byte. The last
+   page is not flushed: the reader takes it, and the pipe is destroyed once every message is read. */
+static void pipe_benchmark_message_producer(void *pipe_) {
+  uint8_t message[BENCHMARK_MESSAGE_SIZE];
+  struct pipe *pipe = pipe_;
+  int i;
+
+  memset(message, 0, sizeof message);
+  for (i = 0; i < BENCHMARK_MESSAGES; i++) {
+    message[0] = i;
+    pipe_write(pipe, message, sizeof message, true);
+  }
+}
+
+/* Returns the throughput in MB/s of BYTES transferred in TIME microseconds. */
+static int pipe_benchmark_rate(int bytes, int time) {
+  return time > 0 ? bytes / time : 0;
+}
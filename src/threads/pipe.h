@@ -0,0 +1,33 @@
+/*
+ * pipe.h
+ *
+ * Pipes between threads that pass whole pages without copying them, and message queues that
+ * batch small messages into those pages. See pipe.c.
+ */
+
+#ifndef THREADS_PIPE_H_
+#define THREADS_PIPE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Largest message of pipe_write(). */
+#define PIPE_MESSAGE_MAX 1024
+
+struct pipe;
+
+struct pipe *pipe_create(void);
+void pipe_destroy(struct pipe *pipe);
+
+/* Page passing. */
+bool pipe_send_page(struct pipe *pipe, void *page, size_t length, bool block);
+void *pipe_receive_page(struct pipe *pipe, size_t *length, bool block);
+
+/* Message queue. */
+bool pipe_write(struct pipe *pipe, const void *message, size_t size, bool block);
+bool pipe_flush(struct pipe *pipe, bool block);
+int pipe_read(struct pipe *pipe, void *buffer, size_t size, bool block);
+
+void pipe_benchmark(void);
+
+#endif /* THREADS_PIPE_H_ */
@@ -0,0 +1,16 @@
+#ifndef THREADS_REGION_H
+#define THREADS_REGION_H
+
+#include <stddef.h>
+
+/* Region (bump) allocator for objects that are freed all together.
+   See region.c for details. */
+struct region;
+
+struct region *region_create (size_t chunk_pages);
+void *region_alloc (struct region *, size_t size);
+void region_reset (struct region *);
+void region_destroy (struct region *);
+void region_benchmark (void);
+
+#endif /* threads/region.h */
@@ -0,0 +1,162 @@
+/*
+ * shm.c
+ *
+ * Named shared memory regions. A region is a run of zeroed pages of the user pool that is found
+ * by its name: every thread that opens the same name gets the same pages. The kernel threads use
+ * them through shm_address(), and shm_map() maps them in a user address space.
+ *
+ * The pages are counted in the frame table (frame.c): the region holds one reference and every
+ * mapping another one, so a page is released when the region is closed by its last user and no
+ * address space maps it anymore. The frames are marked as shared memory, so thread_clone() keeps
+ * their writable mappings writable in both processes instead of making them copy-on-write.
+ *
+ * The futexes (futex.h) can be used on the words of a region to wait for the other side.
+ */
+
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+
+#include "frame.h"
+#include "malloc.h"
+#include "mmu.h"
+#include "palloc.h"
+#include "shm.h"
+#include "synch.h"
+#include "vaddr.h"
+
+/* Shared memory region. */
+struct shm_region {
+  struct hash_elem elem;        /* Element of the shm_regions table. */
+  char name[SHM_NAME_MAX + 1];  /* Name. */
+  uint8_t *pages;               /* First page (kernel address). */
+  size_t page_cnt;              /* Number of pages. */
+  unsigned open_cnt;            /* Number of shm_open() without shm_close(). */
+};
+
+/* Open regions, by name, and lock that protects them. */
+static struct hash shm_regions;
+static struct lock shm_lock;
+
+static unsigned shm_region_hash(const struct hash_elem *e, void *aux);
+static bool shm_region_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
+
+/* Initializes the shared memory regions. It has to be called after malloc_init(). */
+void shm_init(void) {
+  if (!hash_init(&shm_regions, shm_region_hash, shm_region_less, NULL)) {
+    PANIC("shm_init: out of memory");
+  }
+  lock_init(&shm_lock);
+}
+
+/* Opens the region NAME, creating it with PAGE_CNT zeroed pages if it doesn't exist. Returns NULL
+   if there is no memory, or if the region exists and has fewer than PAGE_CNT pages. */
+struct shm_region *shm_open(const char *name, size_t page_cnt) {
+  struct shm_region key, *region;
+  struct hash_elem *e;
+  size_t i;
+
+  ASSERT (name != NULL && strlen(name) <= SHM_NAME_MAX);
+  ASSERT (page_cnt > 0);
+
+  strlcpy(key.name, name, sizeof key.name);
+
+  lock_acquire(&shm_lock);
+  e = hash_find(&shm_regions, &key.elem);
+  if (e != NULL) {
+    region = hash_entry(e, struct shm_region, elem);
+    if (region->page_cnt < page_cnt) {
+      region = NULL;
+    } else {
+      region->open_cnt++;
+    }
+    lock_release(&shm_lock);
+    return region;
+  }
+
+  region = malloc(sizeof *region);
+  if (region != NULL) {
+    region->pages = palloc_get_multiple(PAL_USER | PAL_ZERO, page_cnt);
+    if (region->pages == NULL) {
+      free(region);
+      region = NULL;
+    }
+  }
+  if (region != NULL) {
+    for (i = 0; i < page_cnt; i++) {
+      frame_set_shared_memory(region->pages + i * PGSIZE);
+    }
+    strlcpy(region->name, name, sizeof region->name);
+    region->page_cnt = page_cnt;
+    region->open_cnt = 1;
+    hash_insert(&shm_regions, &region->elem);
+  }
+  lock_release(&shm_lock);
+
+  return region;
+}
+
+/* Closes REGION. The last close removes its name; its pages are released once no address space
+   maps them. */
+void shm_close(struct shm_region *region) {
+  size_t i;
+
+  ASSERT (region != NULL && region->open_cnt > 0);
+
+  lock_acquire(&shm_lock);
+  if (--region->open_cnt > 0) {
+    lock_release(&shm_lock);
+    return;
+  }
+  hash_delete(&shm_regions, &region->elem);
+  lock_release(&shm_lock);
+
+  for (i = 0; i < region->page_cnt; i++) {
+    frame_release(region->pages + i * PGSIZE);
+  }
+  free(region);
+}
+
+/* Returns the kernel address of the first byte of REGION. */
+void *shm_address(struct shm_region *region) {
+  ASSERT (region != NULL);
+  return region->pages;
+}
+
+/* Returns the number of pages of REGION. */
+size_t shm_page_cnt(struct shm_region *region) {
+  ASSERT (region != NULL);
+  return region->page_cnt;
+}
+
+/* Maps the pages of REGION in AS, starting at the user page UPAGE. They are read-only in user
+   mode unless WRITABLE. Returns false if there is no memory for the page tables; the pages that
+   were already mapped stay mapped. */
+bool shm_map(struct shm_region *region, struct address_space *as, void *upage, bool writable) {
+  uint8_t *page = upage;
+  size_t i;
+
+  ASSERT (region != NULL);
+
+  for (i = 0; i < region->page_cnt; i++, page += PGSIZE) {
+    void *kpage = region->pages + i * PGSIZE;
+    frame_share(kpage);
+    if (!mmu_map_user_page(as, page, kpage, writable)) {
+      frame_release(kpage);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Hash function of the regions: their name. */
+static unsigned shm_region_hash(const struct hash_elem *e, void *aux UNUSED) {
+  return hash_string(hash_entry(e, struct shm_region, elem)->name);
+}
+
+/* Orders the regions by name. */
+static bool shm_region_less(const struct hash_elem *a, const struct hash_elem *b,
+    void *aux UNUSED) {
+  return strcmp(hash_entry(a, struct shm_region, elem)->name,
+      hash_entry(b, struct shm_region, elem)->name) < 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * shm.h
+ *
+ * Named shared memory regions. See shm.c.
+ */
+
+#ifndef THREADS_SHM_H_
+#define THREADS_SHM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Longest name of a region. */
+#define SHM_NAME_MAX 15
+
+struct address_space;
+struct shm_region;
+
+void shm_init(void);
+struct shm_region *shm_open(const char *name, size_t page_cnt);
+void shm_close(struct shm_region *region);
+void *shm_address(struct shm_region *region);
+size_t shm_page_cnt(struct shm_region *region);
+bool shm_map(struct shm_region *region, struct address_space *as, void *upage, bool writable);
+
+#endif /* THREADS_SHM_H_ */
@@ -27,8 +27,9 @@
 */
 
 #include "synch.h"
-//#include <stdio.h>
+#include <stdio.h>
 #include <string.h>
+#include "../devices/timer.h"
 #include "interrupt.h"
 #include "thread.h"
 
@@ -65,14 +66,14 @@ sema_down (struct semaphore *sema)
   ASSERT (sema != NULL);
   ASSERT (!interrupts_context());
 
-  old_level = interrupts_disable ();
+  old_level = interrupts_save ();
   while (sema->value == 0) 
     {
       list_push_back (&sema->waiters, &thread_current ()->elem);
       thread_block ();
     }
   sema->value--;
-  interrupts_set_level (old_level);
+  interrupts_restore (old_level);
 }
 
 /* Down or "P" operation on a semaphore, but only if the
@@ -88,7 +89,7 @@ sema_try_down (struct semaphore *sema)
 
   ASSERT (sema != NULL);
 
-  old_level = interrupts_disable ();
+  old_level = interrupts_save ();
   if (sema->value > 0) 
     {
       sema->value--;
@@ -96,7 +97,7 @@ sema_try_down (struct semaphore *sema)
     }
   else
     success = false;
-  interrupts_set_level (old_level);
+  interrupts_restore (old_level);
 
   return success;
 }
@@ -112,12 +113,12 @@ sema_up (struct semaphore *sema)
 
   ASSERT (sema != NULL);
 
-  old_level = interrupts_disable ();
+  old_level = interrupts_save ();
   if (!list_empty (&sema->waiters)) 
     thread_unblock (list_entry (list_pop_front (&sema->waiters),
                                 struct thread, elem));
   sema->value++;
-  interrupts_set_level (old_level);
+  interrupts_restore (old_level);
 }
 
 static void sema_test_helper (void *sema_);
@@ -336,3 +337,62 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Number of pairs done by synch_benchmark() for each measure. */
+#define BENCHMARK_ROUNDS 10000
+
+/* Measures the cost of masking the interrupts, with the out-of-line functions
+   (interrupts_disable() and interrupts_set_level(), the way the semaphores did it
+   before) and with the inline ones (interrupts_save() and interrupts_restore(), the
+   way they do it now), and of an uncontended lock acquire/release and semaphore
+   down/up pair. Each lock pair masks the interrupts twice (in sema_down() and
+   sema_up()), so it saves twice the difference between the first two. */
+void
+synch_benchmark (void) 
+{
+  enum interrupts_level old_level;
+  struct lock lock;
+  struct semaphore sema;
+  int start, out_of_line_time, inline_time, lock_time, sema_time;
+  int i;
+
+  start = timer_get_timestamp ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    {
+      old_level = interrupts_disable ();
+      interrupts_set_level (old_level);
+    }
+  out_of_line_time = timer_get_timestamp () - start;
+
+  start = timer_get_timestamp ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    {
+      old_level = interrupts_save ();
+      interrupts_restore (old_level);
+    }
+  inline_time = timer_get_timestamp () - start;
+
+  lock_init (&lock);
+  start = timer_get_timestamp ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    {
+      lock_acquire (&lock);
+      lock_release (&lock);
+    }
+  lock_time = timer_get_timestamp () - start;
+
+  sema_init (&sema, 1);
+  start = timer_get_timestamp ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    {
+      sema_down (&sema);
+      sema_up (&sema);
+    }
+  sema_time = timer_get_timestamp () - start;
+
+  printf ("\nSynch benchmark: %d pairs", BENCHMARK_ROUNDS);
+  printf ("\n  interrupts_disable/set_level:  %d us", out_of_line_time);
+  printf ("\n  interrupts_save/restore:       %d us", inline_time);
+  printf ("\n  lock acquire/release:          %d us", lock_time);
+  printf ("\n  sema down/up:                  %d us", sema_time);
+}
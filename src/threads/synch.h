@@ -39,6 +39,8 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+void synch_benchmark (void);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -0,0 +1,144 @@
+/*
+ * syscall.c
+ *
+ * System call dispatch table. swi_handler_int (interruptsHandlers.s) calls the function of the
+ * table that corresponds to the number in r7, with the arguments of the system call as its
+ * parameters, and returns its result in r0. SYS_TIME never gets here: it is answered in the
+ * handler.
+ *
+ * Note: There are no user processes yet, so the pointers are not validated and only the console
+ * can be written.
+ */
+
+#include <console.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../devices/timer.h"
+#include "interrupt.h"
+#include "syscall.h"
+#include "thread.h"
+
+/* Number of system calls. */
+#define SYSCALL_COUNT (SYS_TIME + 1)
+
+/* Signature of the functions of the system calls. */
+typedef int32_t syscall_function(uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+static int32_t syscall_halt(uint32_t arg0, uint32_t arg1, uint32_t arg2);
+static int32_t syscall_exit(uint32_t status, uint32_t arg1, uint32_t arg2);
+static int32_t syscall_write(uint32_t fd, uint32_t buffer, uint32_t size);
+static int32_t syscall_yield(uint32_t arg0, uint32_t arg1, uint32_t arg2);
+static int32_t syscall_time(uint32_t arg0, uint32_t arg1, uint32_t arg2);
+static int32_t syscall_not_implemented(uint32_t arg0, uint32_t arg1, uint32_t arg2);
+int32_t syscall_invalid(uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+/* Functions of the system calls, indexed by their numbers. It is used by swi_handler_int. */
+syscall_function *syscall_table[SYSCALL_COUNT] = {
+  [SYS_HALT] = syscall_halt,
+  [SYS_EXIT] = syscall_exit,
+  [SYS_EXEC] = syscall_not_implemented,
+  [SYS_WAIT] = syscall_not_implemented,
+  [SYS_CREATE] = syscall_not_implemented,
+  [SYS_REMOVE] = syscall_not_implemented,
+  [SYS_OPEN] = syscall_not_implemented,
+  [SYS_FILESIZE] = syscall_not_implemented,
+  [SYS_READ] = syscall_not_implemented,
+  [SYS_WRITE] = syscall_write,
+  [SYS_SEEK] = syscall_not_implemented,
+  [SYS_TELL] = syscall_not_implemented,
+  [SYS_CLOSE] = syscall_not_implemented,
+  [SYS_MMAP] = syscall_not_implemented,
+  [SYS_MUNMAP] = syscall_not_implemented,
+  [SYS_CHDIR] = syscall_not_implemented,
+  [SYS_MKDIR] = syscall_not_implemented,
+  [SYS_READDIR] = syscall_not_implemented,
+  [SYS_ISDIR] = syscall_not_implemented,
+  [SYS_INUMBER] = syscall_not_implemented,
+  [SYS_YIELD] = syscall_yield,
+  [SYS_TIME] = syscall_time,
+};
+
+/* Halts the operating system. */
+static int32_t syscall_halt(uint32_t arg0 UNUSED, uint32_t arg1 UNUSED, uint32_t arg2 UNUSED) {
+  printf("\nHalting the operating system.");
+  interrupts_disable();
+  for (;;);
+  NOT_REACHED();
+}
+
+/* Terminates the current thread. */
+static int32_t syscall_exit(uint32_t status, uint32_t arg1 UNUSED, uint32_t arg2 UNUSED) {
+  printf("\n%s: exit(%d)", thread_name(), (int) status);
+  thread_exit();
+  NOT_REACHED();
+}
+
+/* Writes SIZE bytes from BUFFER to the file FD. Returns the number of bytes written, or -1. */
+static int32_t syscall_write(uint32_t fd, uint32_t buffer, uint32_t size) {
+  if (fd != STDOUT_FILENO) {
+    return -1;
+  }
+
+  putbuf((const char *) buffer, size);
+  return size;
+}
+
+/* Yields the CPU. The thread stays ready to run. */
+static int32_t syscall_yield(uint32_t arg0 UNUSED, uint32_t arg1 UNUSED, uint32_t arg2 UNUSED) {
+  thread_yield();
+  return 0;
+}
+
+/* Returns the system timer counter. swi_handler_int answers SYS_TIME by itself; this is only
+   here to keep the table complete. */
+static int32_t syscall_time(uint32_t arg0 UNUSED, uint32_t arg1 UNUSED, uint32_t arg2 UNUSED) {
+  return timer_get_timestamp();
+}
+
+/* System calls of the file system, the processes and the virtual memory, that don't exist yet. */
+static int32_t syscall_not_implemented(uint32_t arg0 UNUSED, uint32_t arg1 UNUSED,
+    uint32_t arg2 UNUSED) {
+  return -1;
+}
+
+/* Called by swi_handler_int when the number is out of the table. */
+int32_t syscall_invalid(uint32_t arg0 UNUSED, uint32_t arg1 UNUSED, uint32_t arg2 UNUSED) {
+  printf("\nInvalid system call");
+  return -1;
+}
+
+/* Number of system calls done by syscall_benchmark() for each measure. */
+#define BENCHMARK_CALLS 10000
+
+/* Measures the round trip time of SYS_TIME (answered without saving registers) and of SYS_WRITE
+   with 0 bytes (dispatched through the table to C), against a plain call of the same C function.
+   Prints the elapsed system timer ticks (microseconds). */
+void syscall_benchmark(void) {
+  int start, call_time, time_time, write_time;
+  int i;
+
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_CALLS; i++) {
+    syscall_write(STDOUT_FILENO, (uint32_t) "", 0);
+  }
+  call_time = timer_get_timestamp() - start;
+
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_CALLS; i++) {
+    syscall(SYS_TIME, 0, 0, 0);
+  }
+  time_time = timer_get_timestamp() - start;
+
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_CALLS; i++) {
+    syscall(SYS_WRITE, STDOUT_FILENO, (uint32_t) "", 0);
+  }
+  write_time = timer_get_timestamp() - start;
+
+  printf("\nSystem call benchmark: %d calls", BENCHMARK_CALLS);
+  printf("\n  function call:     %d us", call_time);
+  printf("\n  SYS_TIME (fast):   %d us", time_time);
+  printf("\n  SYS_WRITE (table): %d us", write_time);
+}
@@ -0,0 +1,25 @@
+/*
+ * syscall.h
+ *
+ * System calls. They are invoked with the SWI instruction, with the system call number
+ * (lib/syscall-nr.h) in r7 and the arguments in r0-r2. See swi_handler_int in
+ * interruptsHandlers.s.
+ */
+
+#ifndef THREADS_SYSCALL_H_
+#define THREADS_SYSCALL_H_
+
+#include <stdint.h>
+#include <syscall-nr.h>
+
+/* File descriptor of the console. */
+#define STDOUT_FILENO 1
+
+/* Invokes the system call NUMBER with the arguments ARG0, ARG1 and ARG2 and returns its result.
+   It is defined in interruptsHandlers.s. */
+extern int32_t syscall(int number, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+/* Measures the round trip time of the system calls. */
+void syscall_benchmark(void);
+
+#endif /* THREADS_SYSCALL_H_ */
@@ -1,4 +1,5 @@
 
+#include <atomic.h>
 #include <debug.h>
 #include <list.h>
 #include <random.h>
@@ -12,14 +13,19 @@
 #include "../devices/timer.h"
 #include "flags.h"
 #include "interrupt.h"
+#include "mmu.h"
 #include "palloc.h"
 #include "synch.h"
 #include "thread.h"
 #include "vaddr.h"
+#include "vfp.h"
 
 /* Returns the value of the current stack pointer. The function is defined
    in interruptsHandlers.s. */
 extern void * get_current_sp(void);
+/* Zeroes SIZE bytes at DEST, which must be a multiple of 32. The function is defined in
+   memoryCopy.s. */
+extern void memory_fast_zero(void *dest, int size);
 /* This function does a context switch by:
     - Saving the stack frame or context of the previous thread.
     - Calling thread_schedule_tail(previous, next).
@@ -32,6 +38,11 @@ extern void save_and_switch_context(struct interrupts_stack_frame *cur_stack_fra
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
+/* If true, every thread created by thread_create() gets an unmapped guard page below its page,
+   so a stack overflow causes a data abort instead of corrupting the memory below. It costs one
+   page of memory per thread. */
+#define THREAD_STACK_GUARD true
+
 /* List of processes in THREAD_READY state, that is, processes
    that are ready to run but not actually running. */
 static struct list ready_list;
@@ -50,13 +61,15 @@ static struct thread *initial_thread;
 static struct lock tid_lock;
 
 /* Statistics. */
-static uint64_t idle_ticks;    /* # of timer ticks spent idle. */
-static uint64_t kernel_ticks;  /* # of timer ticks in kernel threads. */
-static uint64_t user_ticks;    /* # of timer ticks in user programs. */
+/* The tick counters are updated and read with the atomic operations (atomic.h), without disabling
+   the interrupts. */
+static volatile uint64_t idle_ticks;    /* # of timer ticks spent idle. */
+static volatile uint64_t kernel_ticks;  /* # of timer ticks in kernel threads. */
+static volatile uint64_t user_ticks;    /* # of timer ticks in user programs. */
 
 /* Scheduling. */
 #define TIME_SLICE 2            /* # of timer ticks to give each thread. */
-static uint32_t thread_ticks;   /* # of timer ticks since last yield. */
+static volatile uint32_t thread_ticks;   /* # of timer ticks since last yield. */
 
 /* Stack address to be allocated for the different threads. */
 //static uint32_t thread_memory_loc = MEMORY_THREAD_BASE;
@@ -79,6 +92,8 @@ static void context_switch(struct thread* next_thread, struct interrupts_stack_f
 static bool is_thread (struct thread *t);
 static struct thread *get_first_thread();
 static tid_t allocate_tid (void);
+static tid_t create_thread(const char *name, int32_t priority, thread_func *function,
+    void *aux_parameter, struct address_space *address_space);
 
 /* Does basic initialization of t as a blocked thread named NAME. */
 static void init_thread (struct thread *t, const char *name, int priority);
@@ -128,6 +143,7 @@ static void init_thread (struct thread *t, const char *name, int priority) {
   t->stack_frame.r13_sp = get_current_sp();
   t->priority = priority;
   t->magic = THREAD_MAGIC;
+  vfp_init_state(&t->vfp);
   list_push_back (&all_list, &t->allelem);
 
   /* Setting the current interrupts stack frame. */
@@ -182,14 +198,13 @@ void thread_tick (struct interrupts_stack_frame *stack_frame) {
 
   /* Update statistics. */
   if (t == idle_thread) {
-      idle_ticks++;
+      atomic_add_64(&idle_ticks, 1);
   } else {
-      kernel_ticks++;
+      atomic_add_64(&kernel_ticks, 1);
   }
 
   /* Enforce preemption. */
-  ++thread_ticks;
-  if (thread_ticks >= TIME_SLICE) {
+  if (atomic_add(&thread_ticks, 1) >= TIME_SLICE) {
     interrupts_yield_on_return();
   }
 }
@@ -197,7 +212,8 @@ void thread_tick (struct interrupts_stack_frame *stack_frame) {
 /* Prints thread statistics. */
 void thread_print_stats (void) {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
-          idle_ticks, kernel_ticks, user_ticks);
+          atomic_read_64(&idle_ticks), atomic_read_64(&kernel_ticks),
+          atomic_read_64(&user_ticks));
 }
 
 /* Creates a new kernel thread named NAME with the given initial PRIORITY, which executes
@@ -214,6 +230,37 @@ void thread_print_stats (void) {
   */
 tid_t thread_create(const char *name, int32_t priority,
     thread_func *function, void *aux_parameter) {
+  return create_thread(name, priority, function, aux_parameter, NULL);
+}
+
+/* Creates a new thread like thread_create(), but running in a copy of the address space of the
+   running thread (fork). The pages are shared by copy-on-write, so both threads see the same
+   contents until one of them writes to a page. Returns TID_ERROR if there is no memory.
+
+   The running thread must have a user address space. */
+tid_t thread_clone(const char *name, int32_t priority,
+    thread_func *function, void *aux_parameter) {
+  struct address_space *address_space;
+  tid_t tid;
+
+  ASSERT (thread_current()->address_space != NULL);
+
+  address_space = mmu_address_space_clone(thread_current()->address_space);
+  if (address_space == NULL) {
+    return TID_ERROR;
+  }
+
+  tid = create_thread(name, priority, function, aux_parameter, address_space);
+  if (tid == TID_ERROR) {
+    mmu_address_space_destroy(address_space);
+  }
+  return tid;
+}
+
+/* Creates the thread of thread_create() and thread_clone(), with the user address space
+   ADDRESS_SPACE (NULL for a kernel thread), which becomes owned by the thread. */
+static tid_t create_thread(const char *name, int32_t priority, thread_func *function,
+    void *aux_parameter, struct address_space *address_space) {
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
   ASSERT (function != NULL);
@@ -221,16 +268,31 @@ tid_t thread_create(const char *name, int32_t priority,
   enum interrupts_level old_level;
   tid_t tid;
 
+  /* The pages are allocated and zeroed with the interrupts on: nobody else can see the thread
+     until it is added to all_list. */
+  struct thread *thread;
+  if (THREAD_STACK_GUARD) {
+      /* Only the thread's page is zeroed: the guard page is never read. */
+      uint8_t *pages = palloc_get_multiple(0, 2);
+      if (pages == NULL) {
+          return TID_ERROR;
+      }
+      thread = (struct thread *) (pages + PGSIZE);
+      memory_fast_zero(thread, PGSIZE);
+      thread->guard_page = pages;
+      mmu_unmap_page(pages);  // Without memory for the page table, the thread runs unguarded.
+  } else {
+      thread = palloc_get_page(PAL_ZERO);
+      if (thread == NULL) {
+          return TID_ERROR;
+      }
+  }
+
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack'
      member cannot be observed. */
   old_level = interrupts_disable ();
 
-  struct thread *thread = palloc_get_page(PAL_ZERO);
-  if (thread == NULL) {
-      return TID_ERROR;
-  }
-
   // Setting the tid number.
   tid = thread->tid = allocate_tid();
 
@@ -239,6 +301,8 @@ tid_t thread_create(const char *name, int32_t priority,
   thread->priority = priority;
   thread->magic = THREAD_MAGIC;
   thread->function = (thread_func *) function;
+  thread->address_space = address_space;
+  vfp_init_state(&thread->vfp);
 
   /* Setting the Stack Pointer. Note that we are subtracting -4, so when pg_round_down() is called
      to get the current thread, it returns the right page boundary. */
@@ -250,8 +314,8 @@ tid_t thread_create(const char *name, int32_t priority,
   thread->stack_frame.r15_pc = (void *) kernel_thread;
 
   // Setting the CPSR
-  // TODO Change to USER's mode.
-  thread->stack_frame.cpsr = SYS_MODE | FLAG_FIQ; // User's mode with the FIQ disable.
+  // The threads with an address space run in SYS mode too, see the scope note in mmu.c.
+  thread->stack_frame.cpsr = SYS_MODE; // The FIQ is enabled: no source is routed to it by default.
 
   // Setting the return address (Link Register - LR)
   thread->stack_frame.r14_lr = (void *) 0;
@@ -293,11 +357,11 @@ void thread_unblock (struct thread *t) {
 
   ASSERT (is_thread (t));
 
-  old_level = interrupts_disable ();
+  old_level = interrupts_save ();
   ASSERT (t->status == THREAD_BLOCKED);
   list_push_back (&ready_list, &t->elem);
   t->status = THREAD_READY;
-  interrupts_set_level (old_level);
+  interrupts_restore (old_level);
 }
 
 /* Returns the name of the running thread. */
@@ -333,6 +397,17 @@ void thread_exit (void) {
   ASSERT (!interrupts_context ());
   ASSERT (thread_current()->status == THREAD_RUNNING)
 
+  /* The address space is destroyed here and not in thread_schedule_tail(), because it is
+     released with free(), which takes the malloc lock. The kernel table is activated first. */
+  struct address_space *address_space = thread_current()->address_space;
+  if (address_space != NULL) {
+    enum interrupts_level old_level = interrupts_disable();
+    mmu_address_space_activate(NULL);
+    thread_current()->address_space = NULL;
+    interrupts_set_level(old_level);
+    mmu_address_space_destroy(address_space);
+  }
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
@@ -433,6 +508,15 @@ void thread_schedule_tail(struct thread *prev, struct thread *next) {
   /* Mark us as running. */
   next->status = THREAD_RUNNING;
 
+  /* Switches the first 1 GB of the address space (TTBR0 and ASID). The kernel threads share the
+     kernel table, so switching between them doesn't touch the MMU. */
+  if (prev->address_space != next->address_space) {
+    mmu_address_space_activate(next->address_space);
+  }
+
+  /* The first floating point instruction of NEXT is trapped, unless it owns the VFP registers. */
+  vfp_context_switch(prev, next);
+
   /* If the thread we switched from is dying, destroy its struct
      thread.  This must happen late so that thread_exit() doesn't
      pull out the rug under itself.  (We don't free
@@ -442,12 +526,31 @@ void thread_schedule_tail(struct thread *prev, struct thread *next) {
        ASSERT (prev != next)
        printf("\nReleasing resources of : %s, TID: %d", prev->name, prev->tid);
 
-       /* Releasing the memory that was assigned to this thread. */
-       palloc_free_page(prev);
+       /* Releasing the memory that was assigned to this thread. Its address space was destroyed
+          by thread_exit(). */
+       if (prev->guard_page != NULL) {
+           mmu_remap_page(prev->guard_page);
+           palloc_free_multiple(prev->guard_page, 2);
+       } else {
+           palloc_free_page(prev);
+       }
        timer_msleep(1000000);
    }
 }
 
+/* Returns the thread whose stack guard page contains ADDRESS, which has to be in a page unmapped
+   by mmu_unmap_page() (only the guard pages are). It is used by the data abort handler to report
+   stack overflows.
+
+   The thread is found from the address, without walking all_list: an overflow that reaches the
+   guard page has gone through the struct thread at the bottom of the stack page first, list links
+   included. Returns NULL if that struct thread was overwritten. */
+struct thread *thread_from_stack_guard (const void *address) {
+  struct thread *t = (struct thread *) ((uint8_t *) pg_round_down (address) + PGSIZE);
+
+  return t->magic == THREAD_MAGIC && t->guard_page == pg_round_down (address) ? t : NULL;
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void thread_foreach (thread_action_func *func, void *aux) {
@@ -502,7 +605,9 @@ int thread_get_recent_cpu (void) {
   once initially, at which point it initializes idle_thread, "up"s the semaphore passed to it
   to enable thread_start() to continue, and immediately blocks. After that, the idle thread never
   appears in the ready list. It is returned by thread_get_next_thread_to_run() as a special
-  case when the ready list is empty. */
+  case when the ready list is empty.
+
+  Every time it runs, it refills palloc's cache of pre-zeroed pages. */
 static void idle (void *idle_started_ UNUSED) {
   ASSERT(idle_started_ != NULL);
 
@@ -515,6 +620,9 @@ static void idle (void *idle_started_ UNUSED) {
   for(;;) {
       SetForeColour(green);
       printf("\nIdle thread....");
+
+      /* Use the spare cycles to zero pages for palloc_get_page(PAL_ZERO). */
+      palloc_refill_zeroed_pages();
       timer_msleep(1000000);
 
       /* Let someone else run. */
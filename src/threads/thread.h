@@ -11,6 +11,7 @@
 #include <debug.h>
 #include <stdint.h>
 #include "interrupt.h"
+#include "vfp.h"
 
 #include "../lib/kernel/list.h"
 
@@ -83,7 +84,13 @@ typedef void thread_func(void *parameter);
    an assertion failure in thread_current(), which checks that
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
-   value, triggering the assertion. */
+   value, triggering the assertion.
+
+   When THREAD_STACK_GUARD is true (thread.c), the page below the
+   thread's page is unmapped, so an overflow that goes past the
+   `struct thread' causes a data abort that reports the overflowing
+   thread.  By then the overflow has usually overwritten the
+   `struct thread', so the report can only give its address. */
 
 /* The `elem' member has a dual purpose.  It can be an element in
    the run queue (thread.c), or it can be an element in a
@@ -104,7 +111,14 @@ struct thread {
   /* Share between thread.c and synch.c. */
   struct list_elem elem;        /* List element. */
 
+  /* Owned by mmu.c. */
+  struct address_space *address_space;  /* User address space, or NULL for kernel threads. */
+
+  /* Owned by vfp.c. */
+  struct vfp_state vfp;         /* VFP registers, while another thread owns the VFP. */
+
   /* Owned by thread.c. */
+  uint8_t *guard_page;          /* Unmapped page below the stack, or NULL. */
   uint32_t magic;               /* Detects stack overflow. */
 };
 
@@ -112,6 +126,7 @@ void thread_init(void);
 void thread_start();
 
 tid_t thread_create(const char *name, int32_t priority, thread_func *function, void *aux_parameter);
+tid_t thread_clone(const char *name, int32_t priority, thread_func *function, void *aux_parameter);
 
 void thread_block(void);
 void thread_unblock(struct thread *t);
@@ -123,6 +138,8 @@ const char *thread_name (void);
 void thread_tick (struct interrupts_stack_frame *stack_frame);
 void thread_print_stats (void);
 
+struct thread *thread_from_stack_guard (const void *address);
+
 void thread_exit (void);
 void thread_yield();
 void thread_schedule_tail(struct thread *prev, struct thread *next);
@@ -0,0 +1,106 @@
+/*
+ * vfp.c
+ *
+ * Lazy switching of the VFP registers. The VFP holds the registers of one thread, its owner. On
+ * every context switch the VFP is disabled (FPEXC.EN = 0) unless the next thread is the owner, so
+ * the first floating point instruction of another thread is an undefined instruction. The
+ * handler (undefined_handler_int in interruptsHandlers.s) calls vfp_switch(), which saves the
+ * registers of the owner, loads the ones of the current thread and makes it the owner. The
+ * threads that don't use floating point never pay for saving or restoring the VFP registers.
+ *
+ * The threads start with the VFP in RunFast mode (flush-to-zero and default NaN, no exception
+ * traps enabled), in which the VFP11 handles every operation in hardware. In the other modes
+ * some operations are bounced to support code, which this kernel doesn't have.
+ *
+ * Floating point is only compiled into the kernel with FLOAT=hard (see the Makefile). The code
+ * that runs in interrupt handlers must not use it: an undefined instruction out of a thread
+ * panics.
+ */
+
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../devices/timer.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "vfp.h"
+
+/* FPSCR of RunFast mode: FZ (flush-to-zero) and DN (default NaN). */
+#define FPSCR_RUNFAST ((1 << 24) | (1 << 25))
+
+/* Functions defined in vfp.s. */
+extern void vfp_set_enabled(bool enabled);
+extern void vfp_save(struct vfp_state *state);
+extern void vfp_restore(const struct vfp_state *state);
+
+/* Thread whose registers are in the VFP, or NULL. */
+static struct thread *vfp_owner;
+
+/* Initializes the lazy switching. The access to the VFP is enabled by start.s (vfp.s). */
+void vfp_init(void) {
+  vfp_owner = NULL;
+}
+
+/* Initializes the VFP registers of a new thread. */
+void vfp_init_state(struct vfp_state *state) {
+  memset(state->registers, 0, sizeof state->registers);
+  state->fpscr = FPSCR_RUNFAST;
+}
+
+/* Gives the VFP to the current thread: saves the registers of the owner and loads the ones of the
+   current thread. It is called by undefined_handler_int (interruptsHandlers.s) in SYS mode with
+   the interrupts disabled, when a thread that doesn't own the VFP uses it. */
+void vfp_switch(void) {
+  struct thread *cur = thread_current();
+
+  ASSERT (interrupts_get_level() == INTERRUPTS_OFF);
+
+  vfp_set_enabled(true);
+  if (vfp_owner == cur) {
+    return;
+  }
+  if (vfp_owner != NULL) {
+    vfp_save(&vfp_owner->vfp);
+  }
+  vfp_restore(&cur->vfp);
+  vfp_owner = cur;
+}
+
+/* Enables the VFP for NEXT only if it owns the registers. The registers of PREV are forgotten if
+   it is dying. It is called by thread_schedule_tail(). */
+void vfp_context_switch(struct thread *prev, struct thread *next) {
+  ASSERT (interrupts_get_level() == INTERRUPTS_OFF);
+
+  if (prev->status == THREAD_DYING && vfp_owner == prev) {
+    vfp_owner = NULL;
+  }
+  vfp_set_enabled(next == vfp_owner);
+}
+
+/* Number of multiply-adds done by vfp_benchmark(). */
+#define BENCHMARK_OPERATIONS 100000
+
+/* Measures a loop of single precision multiply-adds. Built with FLOAT=soft they are calls to the
+   libgcc routines; with FLOAT=hard they are VFP instructions. Prints the elapsed system timer
+   ticks (microseconds). */
+void vfp_benchmark(void) {
+  volatile float sum = 0.0f;
+  float x = 1.0001f;
+  int start, time;
+  int i;
+
+  start = timer_get_timestamp();
+  for (i = 0; i < BENCHMARK_OPERATIONS; i++) {
+    sum = sum * x + 0.5f;
+  }
+  time = timer_get_timestamp() - start;
+
+#ifdef __ARM_PCS_VFP
+  printf("\nVFP benchmark: %d multiply-adds (hard float)", BENCHMARK_OPERATIONS);
+#else
+  printf("\nVFP benchmark: %d multiply-adds (soft float)", BENCHMARK_OPERATIONS);
+#endif
+  printf("\n  %d us", time);
+}
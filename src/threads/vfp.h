@@ -0,0 +1,27 @@
+/*
+ * vfp.h
+ *
+ * VFP (floating point unit) of the ARM1176JZF-S. The registers are switched lazily between
+ * threads. See vfp.c.
+ */
+
+#ifndef THREADS_VFP_H_
+#define THREADS_VFP_H_
+
+#include <stdint.h>
+
+struct thread;
+
+/* VFP registers of a thread. The layout is used by vfp_save and vfp_restore (vfp.s). */
+struct vfp_state {
+  uint32_t registers[32];       /* d0-d15 (s0-s31). */
+  uint32_t fpscr;               /* Floating-Point Status and Control Register. */
+};
+
+void vfp_init(void);
+void vfp_init_state(struct vfp_state *state);
+void vfp_switch(void);
+void vfp_context_switch(struct thread *prev, struct thread *next);
+void vfp_benchmark(void);
+
+#endif /* THREADS_VFP_H_ */